@@ -0,0 +1,556 @@
+/* greeter_bench.cc
+   Benchmark for the login dialog.
+*/
+/**
+ * @par dilithium - GPL Launcher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/**
+ * Starts a private Xvfb, runs the login dialog of libxlogin.cc in this
+ * process and drives it from a forked child on a connection of its own:
+ * it types into the user name and password boxes, tabs across the
+ * buttons, hovers over every widget and finally presses Escape. The
+ * driver only looks at the screen, a latency is the time from sending an
+ * input to the first change of the dialog's pixels.
+ *
+ * The dialog's own counters come back through the flight recorder, which
+ * this process points at a private file before the dialog opens it, so
+ * the phases and the X requests of every scope are those --trace-json
+ * would show.
+ *
+ * Prints one "name value" line per result, to be kept per commit.
+ *
+ *   greeter_bench [-x server] [-D display] [-k keys] [-t tabs] [-H hovers]
+ *                 [-b background] [-o trace]
+ *
+ * Not built by default, use 'make bench'.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#ifdef HAVE_X11_EXTENSIONS_XTEST_H
+#include <X11/extensions/XTest.h>
+#endif
+
+#include <pwd.h>
+
+#include "privileges.h"
+#include "dilithium.h"
+#include "xlogin.h"
+#include "recorder.h"
+
+extern "C" int xlogin_run(Dilithium *dilithium);
+
+/* dilithium.cc carries main() and the whole launcher, the dialog only
+ * needs the strings this sets up */
+void Dilithium::initialize()
+{
+    lockfile    = &string_lockfile[0];
+    unknown     = &string_unknown[0];
+    xauthority  = &string_xauthority[0];
+    xclient     = &string_xclient[0];
+    xclientargs = &string_xclientargs[0];
+    xserver     = &string_xserver[0];
+    xserverargs = &string_xserverargs[0];
+    display     = &string_display[0];
+
+    memset(string_lockfile, 0, sizeof(string_lockfile));
+    memset(string_unknown, 0, sizeof(string_unknown));
+    memset(string_xauthority, 0, sizeof(string_xauthority));
+    memset(string_xclient, 0, sizeof(string_xclient));
+    memset(string_xclientargs, 0, sizeof(string_xclientargs));
+    memset(string_xserver, 0, sizeof(string_xserver));
+    memset(string_xserverargs, 0, sizeof(string_xserverargs));
+    memset(string_display, 0, sizeof(string_display));
+}
+
+#define MAX_SAMPLES   4096
+#define INPUT_TIMEOUT 1.0       /* seconds an input may take to show */
+
+enum { KEY, TAB, HOVER, KINDS };
+
+static const char* kind_names[KINDS] = { "key", "tab", "hover" };
+
+/* Written by the driver, read by the dialog's process once it is done */
+struct results
+{
+    double t0;                  /* the dialog was asked for */
+    double mapped;              /* seconds after t0 */
+    double first_paint;
+    double interactive;
+    int    samples[KINDS];
+    int    missed[KINDS];
+    double latency[KINDS][MAX_SAMPLES];
+    int    inputs;
+    pid_t  server;
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+/* Xvfb writes the display it picked to -displayfd */
+static pid_t start_server(const std::string& server, int* number)
+{
+    int fds[2];
+    char buffer[16];
+    char fd[8];
+
+    if (pipe(fds) != 0) {
+        std::perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        close(fds[0]);
+        std::snprintf(fd, sizeof(fd), "%d", fds[1]);
+        execlp(server.c_str(), server.c_str(), "-displayfd", fd, "-nolisten", "tcp",
+               "-screen", "0", "1024x768x24", (char*) NULL);
+        std::perror(server.c_str());
+        _exit(127);
+    }
+    close(fds[1]);
+
+    struct pollfd p = { fds[0], POLLIN, 0 };
+    ssize_t got = 0;
+
+    if (pid > 0 && poll(&p, 1, 10000) > 0)
+        got = read(fds[0], buffer, sizeof(buffer) - 1);
+    close(fds[0]);
+
+    if (got <= 0) {
+        std::fprintf(stderr, "greeter_bench: %s did not start\n", server.c_str());
+        if (pid > 0)
+            kill(pid, SIGTERM);
+        return -1;
+    }
+    buffer[got] = '\0';
+    *number = std::atoi(buffer);
+
+    return pid;
+}
+
+/* --------------------------------------------------------------- driver */
+
+static Window find_dialog(Display* x)
+{
+    Window root, parent, *children = NULL, dialog = None;
+    unsigned int n;
+
+    if (!XQueryTree(x, DefaultRootWindow(x), &root, &parent, &children, &n))
+        return None;
+
+    for (unsigned int i = 0; i < n && dialog == None; i++) {
+        XWindowAttributes a;
+        char* name = NULL;
+
+        if (XGetWindowAttributes(x, children[i], &a) && a.map_state == IsViewable &&
+            XFetchName(x, children[i], &name) && name) {
+            if (std::strcmp(name, "Dilithium Login") == 0)
+                dialog = children[i];
+            XFree(name);
+        }
+    }
+    if (children)
+        XFree(children);
+
+    return dialog;
+}
+
+/* FNV-1a of the dialog's pixels, children included */
+static unsigned long long snapshot(Display* x, Window w, bool* uniform = NULL)
+{
+    XWindowAttributes a;
+    unsigned long long h = 14695981039346656037ULL;
+
+    if (!XGetWindowAttributes(x, w, &a))
+        return 0;
+
+    XImage* image = XGetImage(x, w, 0, 0, a.width, a.height, AllPlanes, ZPixmap);
+
+    if (!image)
+        return 0;
+
+    size_t size = (size_t) image->bytes_per_line * image->height;
+    const unsigned char* p = (const unsigned char*) image->data;
+
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+
+    if (uniform) {
+        unsigned long first = XGetPixel(image, 0, 0);
+        *uniform = true;
+        for (int y = 0; y < image->height && *uniform; y += 4)
+            for (int x = 0; x < image->width && *uniform; x += 4)
+                *uniform = XGetPixel(image, x, y) == first;
+    }
+
+    XDestroyImage(image);
+
+    return h;
+}
+
+static void send_key(Display* x, KeySym sym)
+{
+    KeyCode code = XKeysymToKeycode(x, sym);
+
+#ifdef HAVE_X11_EXTENSIONS_XTEST_H
+    XTestFakeKeyEvent(x, code, True, CurrentTime);
+    XTestFakeKeyEvent(x, code, False, CurrentTime);
+#else
+    Window focus;
+    int revert;
+    XKeyEvent e;
+
+    XGetInputFocus(x, &focus, &revert);
+
+    memset(&e, 0, sizeof(e));
+    e.display     = x;
+    e.window      = focus;
+    e.root        = DefaultRootWindow(x);
+    e.time        = CurrentTime;
+    e.same_screen = True;
+    e.keycode     = code;
+
+    e.type = KeyPress;
+    XSendEvent(x, focus, True, KeyPressMask, (XEvent*) &e);
+    e.type = KeyRelease;
+    XSendEvent(x, focus, True, KeyReleaseMask, (XEvent*) &e);
+#endif
+    XFlush(x);
+}
+
+static void move_pointer(Display* x, int px, int py)
+{
+#ifdef HAVE_X11_EXTENSIONS_XTEST_H
+    XTestFakeMotionEvent(x, DefaultScreen(x), px, py, CurrentTime);
+#else
+    XWarpPointer(x, None, DefaultRootWindow(x), 0, 0, 0, 0, px, py);
+#endif
+    XFlush(x);
+}
+
+/* Sends one input and waits for the dialog to change */
+static void measure(Display* x, Window dialog, results* r, int kind,
+                    KeySym sym, int px = 0, int py = 0)
+{
+    unsigned long long before = snapshot(x, dialog);
+    double t = now();
+
+    if (kind == HOVER)
+        move_pointer(x, px, py);
+    else
+        send_key(x, sym);
+    r->inputs++;
+
+    while (now() - t < INPUT_TIMEOUT) {
+        if (snapshot(x, dialog) != before) {
+            if (r->samples[kind] < MAX_SAMPLES)
+                r->latency[kind][r->samples[kind]++] = now() - t;
+            return;
+        }
+    }
+    r->missed[kind]++;
+}
+
+static int drive(const char* name, results* r, int keys, int tabs, int hovers)
+{
+    Display* x = NULL;
+    Window dialog = None, focus;
+    int revert;
+    bool uniform = true;
+    double t;
+
+    for (t = now(); !x && now() - t < 5; usleep(1000))
+        x = XOpenDisplay(name);
+
+    if (!x)
+        return 1;
+
+    while ((dialog = find_dialog(x)) == None && now() - r->t0 < 10)
+        usleep(200);
+    if (dialog == None)
+        return 1;
+    r->mapped = now() - r->t0;
+
+    while (snapshot(x, dialog, &uniform) && uniform && now() - r->t0 < 10)
+        ;
+    r->first_paint = now() - r->t0;
+
+    /* interactive once a widget of the dialog has the focus */
+    for (;;) {
+        Window root, parent, *children = NULL;
+        unsigned int n;
+
+        XGetInputFocus(x, &focus, &revert);
+        if (focus != None && focus != PointerRoot &&
+            XQueryTree(x, focus, &root, &parent, &children, &n)) {
+            if (children)
+                XFree(children);
+            if (parent == dialog)
+                break;
+        }
+        if (now() - r->t0 > 10)
+            return 1;
+    }
+    r->interactive = now() - r->t0;
+
+    /* every other key erases the one before, so each of them shows */
+    for (int i = 0; i < keys; i++) {
+        if (i == keys / 2)
+            measure(x, dialog, r, TAB, XK_Tab);
+        measure(x, dialog, r, KEY, i % 2 ? XK_BackSpace : XK_a + (i / 2) % 26);
+    }
+
+    /* password, okay, quit, reboot, shutdown, user name and back */
+    for (int i = 0; i < tabs * 6; i++)
+        measure(x, dialog, r, TAB, XK_Tab);
+
+    int dx, dy;
+    Window child, *children = NULL;
+    Window root, parent;
+    unsigned int n;
+
+    XTranslateCoordinates(x, dialog, DefaultRootWindow(x), 0, 0, &dx, &dy, &child);
+    XQueryTree(x, dialog, &root, &parent, &children, &n);
+
+    for (int i = 0; i < hovers; i++) {
+        for (unsigned int c = 0; c < n; c++) {
+            XWindowAttributes a;
+            if (!XGetWindowAttributes(x, children[c], &a))
+                continue;
+            measure(x, dialog, r, HOVER, 0, dx + a.x + a.width / 2, dy + a.y + a.height / 2);
+        }
+        measure(x, dialog, r, HOVER, 0, 0, 0);
+    }
+    if (children)
+        XFree(children);
+
+    /* the focus is back in the password box, Escape quits */
+    send_key(x, XK_Escape);
+    r->inputs++;
+
+    for (t = now(); find_dialog(x) != None; usleep(1000)) {
+        if (now() - t > 5) {
+            std::fprintf(stderr, "greeter_bench: the dialog does not close\n");
+            if (r->server > 0)
+                kill(r->server, SIGTERM);
+            return 1;
+        }
+    }
+
+    XCloseDisplay(x);
+    return 0;
+}
+
+/* --------------------------------------------------------------- report */
+
+static void print_latency(const results* r, int kind)
+{
+    std::vector<double> ms(r->latency[kind], r->latency[kind] + r->samples[kind]);
+
+    for (size_t i = 0; i < ms.size(); i++)
+        ms[i] *= 1e3;
+    std::sort(ms.begin(), ms.end());
+
+    std::printf("%s_samples %d\n", kind_names[kind], r->samples[kind]);
+    std::printf("%s_missed %d\n", kind_names[kind], r->missed[kind]);
+    std::printf("%s_latency_p50_ms %.3f\n", kind_names[kind], percentile(ms, 0.50));
+    std::printf("%s_latency_p95_ms %.3f\n", kind_names[kind], percentile(ms, 0.95));
+    std::printf("%s_latency_p99_ms %.3f\n", kind_names[kind], percentile(ms, 0.99));
+    std::printf("%s_latency_max_ms %.3f\n", kind_names[kind], ms.empty() ? 0.0 : ms.back());
+}
+
+static void report(const results* r)
+{
+    static const char* scopes[] = { "login_window", "load_background", "event_loop",
+                                    "text_box::paint", "button::paint", "label::paint",
+                                    "greeter" };
+    trace_record record;
+    int64_t ns;
+
+    std::printf("mapped_ms %.3f\n", r->mapped * 1e3);
+    std::printf("first_paint_ms %.3f\n", r->first_paint * 1e3);
+    std::printf("interactive_ms %.3f\n", r->interactive * 1e3);
+
+    if ((ns = trace_interval("greeter-create", "greeter-create")) >= 0)
+        std::printf("greeter_create_ms %.3f\n", ns / 1e6);
+    if ((ns = trace_interval("load-background", "load-background")) >= 0)
+        std::printf("load_background_ms %.3f\n", ns / 1e6);
+
+    for (int k = 0; k < KINDS; k++)
+        print_latency(r, k);
+
+    std::printf("inputs %d\n", r->inputs);
+
+    for (size_t i = 0; i < sizeof(scopes) / sizeof(scopes[0]); i++) {
+        if (!trace_find(TRACE_XSTATS, scopes[i], &record))
+            continue;
+        std::printf("x_requests{%s} %d\n", scopes[i], record.a);
+        std::printf("x_round_trips{%s} %d\n", scopes[i], record.b);
+    }
+
+    if (trace_find(TRACE_XSTATS, "event_loop", &record) && r->inputs > 0) {
+        std::printf("x_requests_per_input %.2f\n", (double) record.a / r->inputs);
+        std::printf("x_round_trips_per_input %.2f\n", (double) record.b / r->inputs);
+    }
+}
+
+static void usage()
+{
+    std::fprintf(stderr,
+        "usage: greeter_bench [-x server] [-D display] [-k keys] [-t tabs] [-H hovers]\n"
+        "                     [-b background] [-o trace]\n"
+        "  -x  X server started with -displayfd, default Xvfb\n"
+        "  -D  use this running display instead, :0 to :9\n"
+        "  -k  keystrokes, half in each text box, default 200\n"
+        "  -t  rounds of tabbing across all widgets, default 5\n"
+        "  -H  rounds of hovering over every widget, default 5\n"
+        "  -b  background image, default %s\n"
+        "  -o  flight recorder file, default /tmp/greeter_bench.<pid>.trace\n",
+        DEFAULT_LOGIN_BG);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string server = "Xvfb", display, background = DEFAULT_LOGIN_BG, trace;
+    int keys = 200, tabs = 5, hovers = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "x:D:k:t:H:b:o:h")) != -1) {
+        switch (opt) {
+        case 'x': server = optarg; break;
+        case 'D': display = optarg; break;
+        case 'k': keys = std::atoi(optarg); break;
+        case 't': tabs = std::atoi(optarg); break;
+        case 'H': hovers = std::atoi(optarg); break;
+        case 'b': background = optarg; break;
+        case 'o': trace = optarg; break;
+        default:  usage(); return 1;
+        }
+    }
+
+    if (trace.empty()) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "/tmp/greeter_bench.%d.trace", (int) getpid());
+        trace = name;
+    }
+
+    results* r = (results*) mmap(NULL, sizeof(results), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+        std::perror("mmap");
+        return 1;
+    }
+    memset(r, 0, sizeof(results));
+
+    if (display.empty()) {
+        int number;
+        char name[8];
+
+        if ((r->server = start_server(server, &number)) < 0)
+            return 1;
+        std::snprintf(name, sizeof(name), ":%d", number);
+        display = name;
+    }
+
+    Dilithium d;
+
+    if (display.size() != 2 || display[0] != ':') {
+        std::fprintf(stderr, "greeter_bench: display %s, the dialog takes :0 to :9\n",
+                     display.c_str());
+        if (r->server > 0)
+            kill(r->server, SIGTERM);
+        return 1;
+    }
+    d.set(d.display, &display[0]);
+    d.login_background = background;
+
+    /* the dialog's trace_open finds the recorder open already */
+    unlink(trace.c_str());
+    trace_open(trace.c_str());
+    trace_event(TRACE_START, time(NULL), 0, "greeter_bench");
+
+    r->t0 = now();
+
+    pid_t driver = fork();
+
+    if (driver == 0)
+        _exit(drive(display.c_str(), r, keys, tabs, hovers));
+
+    int response = xlogin_run(&d);
+    int status = 1;
+
+    if (driver > 0)
+        waitpid(driver, &status, 0);
+
+    if (r->server > 0) {
+        kill(r->server, SIGTERM);
+        waitpid(r->server, NULL, 0);
+    }
+
+    /* xlogin_run closed the recorder on its way out */
+    trace_open(trace.c_str());
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || response != Quit) {
+        std::fprintf(stderr, "greeter_bench: the run did not complete, response %d\n",
+                     response);
+        return 1;
+    }
+
+    report(r);
+    std::printf("trace %s\n", trace.c_str());
+
+    trace_close();
+
+    return 0;
+}
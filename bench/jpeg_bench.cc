@@ -0,0 +1,486 @@
+/* jpeg_bench.cc
+   Benchmark for the jpeg_decode background loader.
+*/
+/**
+ * @par dilithium - GPL Launcher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/**
+ * Decodes the wallpapers in data/ and generated 1080p, 4K and 8K images
+ * with jpeg_decode at depths 16, 24 and 32 and every scale factor, and
+ * reports the decode time, MPix/s, the peak RSS and the allocations of
+ * one decode. Every case runs in its own child, so the peak RSS is that
+ * of the case alone.
+ *
+ * No X server is needed: the XImage is built in memory against a zeroed
+ * Display that only carries the image format XCreateImage reads.
+ *
+ *   jpeg_bench [-D datadir] [-d tmpdir] [-g sizes] [-b depths] [-s scales] [-t seconds]
+ *
+ * jpeg_decode clamps anything wider or higher than 1280 pixels after
+ * scaling to 320x256, such cases are flagged "clamped" and only time the
+ * top left corner of the image.
+ *
+ * Not built by default, use 'make bench'.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <jpeglib.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include "xjpeg.h"
+
+#ifndef BENCH_DATADIR
+#define BENCH_DATADIR "data"
+#endif
+
+/* Allocation counting: malloc and friends are interposed for the whole
+ * process, libjpeg and libX11 included. dlsym itself may allocate, that
+ * is served from a small static arena until the real functions are known.
+ */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void  (*real_free)(void *);
+
+static unsigned long alloc_calls;
+static unsigned long alloc_bytes;
+
+static char   early_arena[4096];
+static size_t early_used;
+
+static void *early_alloc(size_t n)
+{
+    n = (n + 15) & ~(size_t) 15;
+    if (early_used + n > sizeof(early_arena))
+        return NULL;
+    early_used += n;
+    return early_arena + early_used - n;
+}
+
+static bool is_early(void *p)
+{
+    return (char *) p >= early_arena && (char *) p < early_arena + sizeof(early_arena);
+}
+
+static void find_real()
+{
+    static bool finding;
+
+    if (finding)
+        return;
+    finding = true;
+    real_malloc  = (void *(*)(size_t)) dlsym(RTLD_NEXT, "malloc");
+    real_calloc  = (void *(*)(size_t, size_t)) dlsym(RTLD_NEXT, "calloc");
+    real_realloc = (void *(*)(void *, size_t)) dlsym(RTLD_NEXT, "realloc");
+    real_free    = (void (*)(void *)) dlsym(RTLD_NEXT, "free");
+    finding = false;
+}
+
+extern "C" void *malloc(size_t n)
+{
+    if (!real_malloc)
+        find_real();
+    if (!real_malloc)
+        return early_alloc(n);
+    alloc_calls++;
+    alloc_bytes += n;
+    return real_malloc(n);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+    if (!real_calloc)
+        find_real();
+    if (!real_calloc)
+        return early_alloc(n * size);       /* static, so already zeroed */
+    alloc_calls++;
+    alloc_bytes += n * size;
+    return real_calloc(n, size);
+}
+
+extern "C" void *realloc(void *p, size_t n)
+{
+    if (!real_realloc)
+        find_real();
+    if (is_early(p) || !real_realloc) {
+        void *q = malloc(n);
+        if (q && p)
+            std::memcpy(q, p, std::min(n, (size_t) (early_arena + sizeof(early_arena) - (char *) p)));
+        return q;
+    }
+    alloc_calls++;
+    alloc_bytes += n;
+    return real_realloc(p, n);
+}
+
+extern "C" void free(void *p)
+{
+    if (!p || is_early(p))
+        return;
+    if (!real_free)
+        find_real();
+    real_free(p);
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long rss_kb()
+{
+    long pages = 0, resident = 0;
+    FILE *f = std::fopen("/proc/self/statm", "r");
+
+    if (f) {
+        if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        std::fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* What XCreateImage reads from a Display: the image byte and bit order,
+ * the bitmap unit and the pixmap formats. With no formats it falls back
+ * to 16 bits per pixel for depth 16 and 32 for depths 24 and 32, which
+ * is what every TrueColor server the greeter meets uses.
+ */
+static Display *memory_display()
+{
+    static std::vector<char> storage(sizeof(*(_XPrivDisplay) 0));
+    _XPrivDisplay dpy = (_XPrivDisplay) &storage[0];
+    int one = 1;
+
+    dpy->byte_order       = *(char *) &one ? LSBFirst : MSBFirst;
+    dpy->bitmap_bit_order = dpy->byte_order;
+    dpy->bitmap_unit      = 32;
+    dpy->bitmap_pad       = 32;
+    dpy->nformats         = 0;
+
+    return (Display *) dpy;
+}
+
+struct image {
+    std::string path;
+    std::string name;
+    int width, height;
+    bool generated;
+};
+
+static bool read_size(image &img)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    FILE *f = std::fopen(img.path.c_str(), "rb");
+
+    if (!f)
+        return false;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, f);
+    jpeg_read_header(&cinfo, TRUE);
+    img.width  = cinfo.image_width;
+    img.height = cinfo.image_height;
+    jpeg_destroy_decompress(&cinfo);
+    std::fclose(f);
+    return true;
+}
+
+/* A wallpaper like image: two gradients, a few soft bands and some
+ * noise, so it neither compresses to nothing nor is pure noise.
+ */
+static bool generate(const std::string &path, int w, int h)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    std::vector<JSAMPLE> row(w * 3);
+    unsigned int seed = 12345;
+    FILE *f = std::fopen(path.c_str(), "wb");
+
+    if (!f)
+        return false;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, f);
+    cinfo.image_width      = w;
+    cinfo.image_height     = h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space   = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (seed >> 16) % 24;
+            int band  = ((x + y) / 64) % 2 ? 30 : 0;
+            row[x * 3]     = (JSAMPLE) std::min(255, x * 200 / w + noise + band);
+            row[x * 3 + 1] = (JSAMPLE) std::min(255, y * 200 / h + noise);
+            row[x * 3 + 2] = (JSAMPLE) std::min(255, 120 + noise + band);
+        }
+        JSAMPROW rows[1] = { &row[0] };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    std::fclose(f);
+    return true;
+}
+
+struct result {
+    int ok;
+    int out_width, out_height;
+    int decodes;
+    double seconds;                     /* per decode */
+    unsigned long calls, bytes;         /* per decode */
+    long start_kb;
+};
+
+/* In the child: decode until <budget> seconds are used, three times at least */
+static result run_case(const image &img, int depth, int num, int denom, double budget)
+{
+    Display *dpy = memory_display();
+    result r;
+    int didxcreate, success;
+
+    std::memset(&r, 0, sizeof(r));
+    r.start_kb = rss_kb();
+
+    double start = now();
+
+    while (r.decodes < 3 || now() - start < budget) {
+
+        unsigned long calls = alloc_calls, bytes = alloc_bytes;
+        XImage *xim = jpeg_decode(img.path.c_str(), dpy, depth, num, denom,
+                                  &didxcreate, &success);
+        if (r.decodes == 0) {
+            r.calls = alloc_calls - calls;
+            r.bytes = alloc_bytes - bytes;
+        }
+        if (!xim || !success) {
+            if (xim)
+                XDestroyImage(xim);
+            return r;
+        }
+        r.out_width  = xim->width;
+        r.out_height = xim->height;
+        XDestroyImage(xim);
+        r.decodes++;
+    }
+    r.seconds = (now() - start) / r.decodes;
+    r.ok = 1;
+    return r;
+}
+
+static void report(const image &img, int depth, int num, int denom, double budget)
+{
+    int fds[2];
+    struct rusage ru;
+    result r;
+    int status;
+
+    std::memset(&r, 0, sizeof(r));
+    if (pipe(fds) < 0) {
+        std::perror("jpeg_bench: pipe");
+        return;
+    }
+
+    std::fflush(stdout);
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        close(fds[0]);
+        r = run_case(img, depth, num, denom, budget);
+        if (write(fds[1], &r, sizeof(r)) != sizeof(r))
+            _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    if (pid < 0 || read(fds[0], &r, sizeof(r)) != sizeof(r))
+        r.ok = 0;
+    close(fds[0]);
+
+    std::memset(&ru, 0, sizeof(ru));
+    if (pid > 0)
+        wait4(pid, &status, 0, &ru);
+
+    char scale[16], in[24], out[24];
+    std::snprintf(scale, sizeof(scale), "%d/%d", num, denom);
+    std::snprintf(in, sizeof(in), "%dx%d", img.width, img.height);
+
+    if (!r.ok) {
+        std::printf("%-34s %11s %5d %5s  FAILED\n", img.name.c_str(), in, depth, scale);
+        return;
+    }
+    std::snprintf(out, sizeof(out), "%dx%d", r.out_width, r.out_height);
+
+    /* what libjpeg would deliver, see the clamp in jpeg_decode */
+    int want_w = (img.width * num + denom - 1) / denom;
+    int want_h = (img.height * num + denom - 1) / denom;
+    bool clamped = r.out_width != want_w || r.out_height != want_h;
+
+    /* a clamped decode stops after 256 rows, the source rate means nothing */
+    char src[16] = "-";
+    if (!clamped)
+        std::snprintf(src, sizeof(src), "%.1f", img.width * (double) img.height / r.seconds / 1e6);
+
+    std::printf("%-34s %11s %5d %5s %11s %9.3f %8s %8.1f %9ld %9ld %7lu %9.1f%s\n",
+                img.name.c_str(), in, depth, scale, out,
+                r.seconds * 1e3, src,
+                r.out_width * (double) r.out_height / r.seconds / 1e6,
+                ru.ru_maxrss, ru.ru_maxrss - r.start_kb,
+                r.calls, r.bytes / 1024.0,
+                clamped ? "  clamped" : "");
+}
+
+static std::vector<int> parse_list(const char *s)
+{
+    std::vector<int> v;
+    for (char *end; *s; s = end) {
+        v.push_back(std::strtol(s, &end, 10));
+        if (end == s)
+            break;
+        while (*end == ',' || *end == ' ')
+            end++;
+    }
+    return v;
+}
+
+static void usage()
+{
+    std::fprintf(stderr,
+        "usage: jpeg_bench [-D datadir] [-d tmpdir] [-g sizes] [-b depths] [-s scales] [-t seconds]\n"
+        "  -D  directory of the jpegs to decode (default " BENCH_DATADIR ")\n"
+        "  -d  directory for the generated images (default /tmp)\n"
+        "  -g  generated image heights, 16:9 (default 1080,2160,4320, 0 for none)\n"
+        "  -b  depths (default 16,24,32)\n"
+        "  -s  scale denominators, over 1 (default 1,2,4,8)\n"
+        "  -t  seconds to spend on each case (default 0.5)\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *datadir = BENCH_DATADIR;
+    const char *tmpdir = "/tmp";
+    std::vector<int> heights = parse_list("1080,2160,4320");
+    std::vector<int> depths  = parse_list("16,24,32");
+    std::vector<int> denoms  = parse_list("1,2,4,8");
+    double budget = 0.5;
+    std::vector<image> images;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "D:d:g:b:s:t:h")) != -1) {
+        switch (opt) {
+        case 'D': datadir = optarg; break;
+        case 'd': tmpdir = optarg; break;
+        case 'g': heights = parse_list(optarg); break;
+        case 'b': depths = parse_list(optarg); break;
+        case 's': denoms = parse_list(optarg); break;
+        case 't': budget = std::atof(optarg); break;
+        default:  usage(); return 1;
+        }
+    }
+
+    DIR *dir = opendir(datadir);
+    if (dir) {
+        std::vector<std::string> names;
+        for (struct dirent *e; (e = readdir(dir)) != NULL; ) {
+            std::string name(e->d_name);
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".jpg") == 0)
+                names.push_back(name);
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+
+        for (size_t i = 0; i < names.size(); i++) {
+            image img = { std::string(datadir) + "/" + names[i], names[i], 0, 0, false };
+            if (read_size(img))
+                images.push_back(img);
+        }
+    } else {
+        std::fprintf(stderr, "jpeg_bench: no %s, only generated images\n", datadir);
+    }
+
+    for (size_t i = 0; i < heights.size(); i++) {
+        if (heights[i] <= 0)
+            continue;
+
+        char name[64];
+        int h = heights[i], w = h * 16 / 9;
+
+        std::snprintf(name, sizeof(name), "generated-%dx%d.jpg", w, h);
+        image img = { std::string(tmpdir) + "/jpeg_bench." + std::to_string((long) getpid())
+                      + "." + name, name, w, h, true };
+
+        double start = now();
+        if (!generate(img.path, w, h)) {
+            std::fprintf(stderr, "jpeg_bench: could not write %s\n", img.path.c_str());
+            continue;
+        }
+        std::printf("generated %s in %.0f ms\n", name, (now() - start) * 1e3);
+        images.push_back(img);
+    }
+
+    if (images.empty()) {
+        usage();
+        return 1;
+    }
+
+    std::printf("\n%-34s %11s %5s %5s %11s %9s %8s %8s %9s %9s %7s %9s\n",
+                "image", "size", "depth", "scale", "output", "ms", "srcMP/s", "outMP/s",
+                "peakKB", "growthKB", "allocs", "allocKB");
+
+    for (size_t i = 0; i < images.size(); i++)
+        for (size_t d = 0; d < depths.size(); d++)
+            for (size_t s = 0; s < denoms.size(); s++)
+                report(images[i], depths[d], 1, denoms[s], budget);
+
+    for (size_t i = 0; i < images.size(); i++)
+        if (images[i].generated)
+            unlink(images[i].path.c_str());
+
+    return 0;
+}
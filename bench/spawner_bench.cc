@@ -0,0 +1,350 @@
+/* spawner_bench.cc
+   Benchmark for the Spawner start, ready, client, shutdown cycle.
+*/
+/**
+ * @par dilithium - GPL Launcher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/**
+ * Runs Spawner::do_spawn over and over against stub_xserver, which gets
+ * ready and goes away as fast as it is told to, so what is measured is
+ * the supervisor and not Xorg. The client is /bin/true by default.
+ *
+ * The phases come from the flight recorder, pointed at a private file,
+ * the same spans --trace-json shows. After every cycle the bench counts
+ * its open descriptors, its zombie and living children and its RSS.
+ *
+ *   spawner_bench [-n cycles] [-x server] [-c client] [-D display]
+ *                 [-r ready-delay ms] [-e exit-delay ms] [-o trace] [-v]
+ *
+ * Not built by default, use 'make bench'.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* the launcher's headers first and in its order: privileges.h sizes
+ * Privileges by NGROUPS_MAX, <limits.h> must not have set it before */
+#include "common.h"
+#include "global.h"
+#include "privileges.h"
+#include "dilithium.h"
+#include "recorder.h"
+#include "spawner.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/* dilithium.cc carries main() and the whole launcher, the spawner only
+ * needs the strings this sets up and the two calls of the login path */
+void Dilithium::initialize()
+{
+    lockfile    = &string_lockfile[0];
+    unknown     = &string_unknown[0];
+    xauthority  = &string_xauthority[0];
+    xclient     = &string_xclient[0];
+    xclientargs = &string_xclientargs[0];
+    xserver     = &string_xserver[0];
+    xserverargs = &string_xserverargs[0];
+    display     = &string_display[0];
+
+    memset(string_lockfile, 0, sizeof(string_lockfile));
+    memset(string_unknown, 0, sizeof(string_unknown));
+    memset(string_xauthority, 0, sizeof(string_xauthority));
+    memset(string_xclient, 0, sizeof(string_xclient));
+    memset(string_xclientargs, 0, sizeof(string_xclientargs));
+    memset(string_xserver, 0, sizeof(string_xserver));
+    memset(string_xserverargs, 0, sizeof(string_xserverargs));
+    memset(string_display, 0, sizeof(string_display));
+}
+
+int Dilithium::initialize_user()
+{
+    return EXIT_SUCCESS;
+}
+
+bool share_runtime_authority(Dilithium *d)
+{
+    return true;
+}
+
+/* The spans of one cycle, from the begin of the first to the end of the second */
+static const struct {
+    const char *name;
+    const char *from;
+    const char *to;
+} phases[] = {
+    { "fork-server",   "fork-server",   "fork-server"   },
+    { "sigusr1-wait",  "sigusr1-wait",  "sigusr1-wait"  },
+    { "waitforserver", "waitforserver", "waitforserver" },
+    { "server-ready",  "fork-server",   "waitforserver" },
+    { "fork-client",   "fork-client",   "fork-client"   },
+    { "client",        "fork-client",   "first-map"     },
+    { "shutdown",      "shutdown",      "shutdown"      },
+};
+
+#define PHASES (int) (sizeof(phases) / sizeof(phases[0]))
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+static int open_fds()
+{
+    int count = 0;
+    DIR *dir = opendir("/proc/self/fd");
+
+    if (!dir)
+        return -1;
+    for (struct dirent *e; (e = readdir(dir)) != NULL; )
+        if (e->d_name[0] != '.')
+            count++;
+    closedir(dir);
+    return count - 1;                   /* the one opendir holds */
+}
+
+/* children of this process, and how many of them are zombies */
+static int children(int *zombies)
+{
+    DIR *dir = opendir("/proc");
+    int count = 0;
+
+    *zombies = 0;
+    if (!dir)
+        return -1;
+
+    for (struct dirent *e; (e = readdir(dir)) != NULL; ) {
+        if (e->d_name[0] < '0' || e->d_name[0] > '9')
+            continue;
+
+        char path[64], line[512];
+        std::snprintf(path, sizeof(path), "/proc/%s/stat", e->d_name);
+        FILE *f = std::fopen(path, "r");
+        if (!f)
+            continue;
+        char *got = std::fgets(line, sizeof(line), f);
+        std::fclose(f);
+
+        /* pid (comm) state ppid, comm may hold anything */
+        char *paren = got ? std::strrchr(line, ')') : NULL;
+        char state;
+        int ppid;
+        if (paren && std::sscanf(paren + 1, " %c %d", &state, &ppid) == 2 && ppid == getpid()) {
+            count++;
+            if (state == 'Z')
+                (*zombies)++;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+static long rss_kb()
+{
+    long pages = 0, resident = 0;
+    FILE *f = std::fopen("/proc/self/statm", "r");
+
+    if (f) {
+        if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        std::fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int free_display()
+{
+    char path[64];
+
+    for (int n = 1; n < 10; n++) {
+        std::snprintf(path, sizeof(path), "/tmp/.X11-unix/X%d", n);
+        if (access(path, F_OK) != 0)
+            return n;
+    }
+    return -1;
+}
+
+static void usage()
+{
+    std::fprintf(stderr,
+        "usage: spawner_bench [-n cycles] [-x server] [-c client] [-D display]\n"
+        "                     [-r ready-delay ms] [-e exit-delay ms] [-o trace] [-v]\n"
+        "  -n  start, ready, client, shutdown cycles (default 1000)\n"
+        "  -x  X server (default stub_xserver next to this program)\n"
+        "  -c  client (default /bin/true)\n"
+        "  -D  display number, 1 to 9 (default the first free one)\n"
+        "  -r  ms the stub server takes to get ready (default 0)\n"
+        "  -e  ms the stub server takes to exit on SIGTERM (default 0)\n"
+        "  -o  flight recorder file (default a private file in /tmp)\n"
+        "  -v  keep the spawner's messages on stderr\n");
+}
+
+int main(int argc, char **argv)
+{
+    std::string server, client = "/bin/true", trace;
+    int cycles = 1000, number = -1, ready_delay = 0, exit_delay = 0;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:x:c:D:r:e:o:vh")) != -1) {
+        switch (opt) {
+        case 'n': cycles = std::atoi(optarg); break;
+        case 'x': server = optarg; break;
+        case 'c': client = optarg; break;
+        case 'D': number = std::atoi(optarg); break;
+        case 'r': ready_delay = std::atoi(optarg); break;
+        case 'e': exit_delay = std::atoi(optarg); break;
+        case 'o': trace = optarg; break;
+        case 'v': verbose = true; break;
+        default:  usage(); return 1;
+        }
+    }
+
+    if (server.empty()) {
+        std::string self(argv[0]);
+        server = self.rfind('/') == std::string::npos ? "./" : self.substr(0, self.rfind('/') + 1);
+        server += "stub_xserver";
+    }
+    if (number < 0)
+        number = free_display();
+    if (number < 1 || number > 9 || cycles < 1) {
+        usage();
+        return 1;
+    }
+    if (trace.empty())
+        trace = "/tmp/spawner_bench." + std::to_string((long) getpid()) + ".trace";
+
+    Dilithium d;
+    char args[64];
+
+    DropPrivileges = false;
+    RuntimeAuth = false;
+    AdaptiveTimeout = false;
+
+    d.user_name = "spawner_bench";      /* straight to the client, no greeter */
+    std::snprintf(d.xserver, MAX_PATH, "%s", server.c_str());
+    std::snprintf(d.xclient, MAX_PATH, "%s", client.c_str());
+    std::snprintf(args, sizeof(args), "-ready-delay %d -exit-delay %d", ready_delay, exit_delay);
+    std::snprintf(d.xserverargs, MAX_ARG, "%s", args);
+    std::snprintf(d.display, 3, ":%d", number);
+
+    if (!trace_open(trace.c_str())) {
+        std::fprintf(stderr, "spawner_bench: cannot open %s\n", trace.c_str());
+        return 1;
+    }
+
+    /* process_timeout and syslog's LOG_PERROR talk on stderr every cycle */
+    int saved_stderr = dup(2);
+    if (!verbose) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 2);
+        close(null);
+    }
+
+    std::vector<double> samples[PHASES], totals;
+    int fds_start = 0, fds_end = 0, fds_max = 0;
+    int zombies_max = 0, zombies_end = 0, living_end = 0, failed = 0;
+    long rss_start = 0, rss_end = 0;
+
+    for (int i = 0; i < cycles; i++) {
+
+        trace_event(TRACE_START, time(NULL), 0, "spawner_bench");
+
+        double start = now();
+        {
+            Spawner spawner(&d);
+            if (spawner.do_spawn(true) != EXIT_SUCCESS)
+                failed++;
+        }
+        totals.push_back((now() - start) * 1e3);
+
+        for (int p = 0; p < PHASES; p++) {
+            int64_t ns = trace_interval(phases[p].from, phases[p].to);
+            if (ns >= 0)
+                samples[p].push_back(ns / 1e6);
+        }
+
+        int zombies, living = children(&zombies);
+        int fds = open_fds();
+
+        /* the first cycle pays for Xlib's and the recorder's setup */
+        if (i == 0) {
+            fds_start = fds;
+            rss_start = rss_kb();
+        }
+        fds_end = fds;
+        fds_max = std::max(fds_max, fds);
+        zombies_end = zombies;
+        zombies_max = std::max(zombies_max, zombies);
+        living_end = living;
+        rss_end = rss_kb();
+    }
+
+    trace_event(TRACE_STOP, 0);
+    trace_close();
+
+    dup2(saved_stderr, 2);
+    close(saved_stderr);
+
+    std::printf("%d cycles of %s :%d, client %s, %d failed\n",
+                cycles, server.c_str(), number, client.c_str(), failed);
+    std::printf("%-14s %7s %9s %9s %9s %9s\n", "phase ms", "n", "p50", "p95", "p99", "max");
+
+    for (int p = 0; p <= PHASES; p++) {
+        std::vector<double> v = p < PHASES ? samples[p] : totals;
+        std::sort(v.begin(), v.end());
+        std::printf("%-14s %7zu %9.3f %9.3f %9.3f %9.3f\n",
+                    p < PHASES ? phases[p].name : "cycle", v.size(),
+                    percentile(v, 0.50), percentile(v, 0.95), percentile(v, 0.99),
+                    v.empty() ? 0 : v.back());
+    }
+
+    std::printf("fds           after 1st %d, max %d, end %d\n", fds_start, fds_max, fds_end);
+    std::printf("children      zombies max %d, end %d, alive at end %d\n",
+                zombies_max, zombies_end, living_end - zombies_end);
+    std::printf("rss KB        after 1st %ld, end %ld, %+.2f per 1000 cycles\n",
+                rss_start, rss_end,
+                cycles > 1 ? (rss_end - rss_start) * 1000.0 / (cycles - 1) : 0.0);
+    std::printf("trace         %s\n", trace.c_str());
+
+    return fds_end > fds_start || zombies_end > 0 || living_end > 0 || failed > 0;
+}
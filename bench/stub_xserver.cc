@@ -0,0 +1,378 @@
+/* stub_xserver.cc
+   A stand-in for the X server, for benchmarking the Spawner.
+*/
+/**
+ * @par dilithium - GPL Launcher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/**
+ * Behaves the way start_server expects an X server to, and no further:
+ *
+ *  - started with SIGUSR1 ignored, it sends SIGUSR1 to its parent once
+ *    it accepts connections, and with -displayfd it writes the display
+ *    number there, picking a free one if none was given;
+ *  - it listens on /tmp/.X11-unix/X<n>, answers the connection setup
+ *    with one 24 bit TrueColor screen and every core request that has a
+ *    reply with an empty one, which is enough for XOpenDisplay, XSync
+ *    and XCloseDisplay;
+ *  - it exits on SIGTERM or SIGINT, -exit-delay ms later.
+ *
+ *   stub_xserver [:n] [-displayfd fd] [-ready-delay ms] [-exit-delay ms]
+ *
+ * Any other argument, like -auth file or -nolisten tcp, is ignored.
+ *
+ * Not built by default, use 'make bench'.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define SOCKET_DIR "/tmp/.X11-unix"
+
+static volatile sig_atomic_t terminate;
+
+static void on_terminate(int)
+{
+    terminate = 1;
+}
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR && !terminate)
+        ;
+}
+
+static std::string socket_path(int n)
+{
+    char path[64];
+    std::snprintf(path, sizeof(path), SOCKET_DIR "/X%d", n);
+    return path;
+}
+
+struct client {
+    int fd;
+    bool set_up;
+    unsigned short sequence;
+    std::vector<unsigned char> in;
+};
+
+static void put16(std::vector<unsigned char>& v, unsigned short x)
+{
+    v.insert(v.end(), (unsigned char*) &x, (unsigned char*) &x + 2);
+}
+
+static void put32(std::vector<unsigned char>& v, unsigned int x)
+{
+    v.insert(v.end(), (unsigned char*) &x, (unsigned char*) &x + 4);
+}
+
+static void pad(std::vector<unsigned char>& v)
+{
+    while (v.size() % 4)
+        v.push_back(0);
+}
+
+/* The connection setup reply, in the byte order of this host */
+static std::vector<unsigned char> setup_reply()
+{
+    static const char vendor[] = "dilithium stub";
+    std::vector<unsigned char> body, reply;
+
+    put32(body, 1);                     /* release */
+    put32(body, 0x00200000);            /* resource id base */
+    put32(body, 0x001fffff);            /* resource id mask */
+    put32(body, 0);                     /* motion buffer */
+    put16(body, sizeof(vendor) - 1);
+    put16(body, 0xffff);                /* maximum request length */
+    body.push_back(1);                  /* screens */
+    body.push_back(1);                  /* pixmap formats */
+    unsigned int one = 1;
+    body.push_back(*(unsigned char*) &one ? 0 : 1);    /* image byte order */
+    body.push_back(*(unsigned char*) &one ? 0 : 1);    /* bitmap bit order */
+    body.push_back(32);                 /* bitmap unit */
+    body.push_back(32);                 /* bitmap pad */
+    body.push_back(8);                  /* min keycode */
+    body.push_back(255);                /* max keycode */
+    put32(body, 0);
+    body.insert(body.end(), vendor, vendor + sizeof(vendor) - 1);
+    pad(body);
+
+    /* format: depth 24, 32 bits per pixel, pad 32 */
+    body.push_back(24); body.push_back(32); body.push_back(32);
+    body.insert(body.end(), 5, 0);
+
+    /* screen */
+    put32(body, 0x100);                 /* root */
+    put32(body, 0x20);                  /* default colormap */
+    put32(body, 0xffffff);              /* white */
+    put32(body, 0);                     /* black */
+    put32(body, 0);                     /* current input masks */
+    put16(body, 1024); put16(body, 768);
+    put16(body, 270);  put16(body, 203);
+    put16(body, 1);    put16(body, 1);  /* installed maps */
+    put32(body, 0x21);                  /* root visual */
+    body.push_back(0);                  /* backing stores */
+    body.push_back(0);                  /* save unders */
+    body.push_back(24);                 /* root depth */
+    body.push_back(1);                  /* depths */
+
+    /* depth 24 with one TrueColor visual */
+    body.push_back(24); body.push_back(0); put16(body, 1); put32(body, 0);
+    put32(body, 0x21);
+    body.push_back(4);                  /* TrueColor */
+    body.push_back(8);
+    put16(body, 256);
+    put32(body, 0xff0000); put32(body, 0x00ff00); put32(body, 0x0000ff);
+    put32(body, 0);
+
+    reply.push_back(1);                 /* success */
+    reply.push_back(0);
+    put16(reply, 11);
+    put16(reply, 0);
+    put16(reply, body.size() / 4);
+    reply.insert(reply.end(), body.begin(), body.end());
+
+    return reply;
+}
+
+/* The core requests that have a reply */
+static bool has_reply(int opcode)
+{
+    static const unsigned char replies[] = {
+        3, 14, 15, 16, 17, 20, 21, 23, 26, 31, 38, 39, 40, 43, 44, 47,
+        48, 49, 50, 52, 73, 83, 84, 85, 86, 87, 91, 92, 97, 98, 99,
+        101, 103, 106, 108, 110, 116, 117, 118, 119
+    };
+    return std::memchr(replies, opcode, sizeof(replies)) != NULL;
+}
+
+static bool send_all(int fd, const unsigned char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* false when the client is to be dropped */
+static bool serve(client& c)
+{
+    unsigned char buffer[4096];
+    ssize_t n = read(c.fd, buffer, sizeof(buffer));
+
+    if (n <= 0)
+        return n < 0 && errno == EINTR;
+    c.in.insert(c.in.end(), buffer, buffer + n);
+
+    if (!c.set_up) {
+        if (c.in.size() < 12)
+            return true;
+
+        unsigned int one = 1;
+        char order = *(unsigned char*) &one ? 'l' : 'B';
+        if (c.in[0] != order)
+            return false;
+
+        unsigned short name, data;
+        std::memcpy(&name, &c.in[6], 2);
+        std::memcpy(&data, &c.in[8], 2);
+        size_t size = 12 + ((name + 3) & ~3) + ((data + 3) & ~3);
+        if (c.in.size() < size)
+            return true;
+
+        c.in.erase(c.in.begin(), c.in.begin() + size);
+        c.set_up = true;
+
+        std::vector<unsigned char> reply = setup_reply();
+        if (!send_all(c.fd, &reply[0], reply.size()))
+            return false;
+    }
+
+    std::vector<unsigned char> out;
+    size_t used = 0;
+
+    while (c.in.size() - used >= 4) {
+        unsigned short length;
+        std::memcpy(&length, &c.in[used + 2], 2);
+        if (length == 0)                /* no BIG-REQUESTS here */
+            return false;
+        if (c.in.size() - used < (size_t) length * 4)
+            break;
+
+        int opcode = c.in[used];
+        used += length * 4;
+        c.sequence++;
+
+        if (has_reply(opcode)) {
+            unsigned char reply[32];
+            std::memset(reply, 0, sizeof(reply));
+            reply[0] = 1;
+            std::memcpy(&reply[2], &c.sequence, 2);
+            out.insert(out.end(), reply, reply + sizeof(reply));
+        }
+    }
+    c.in.erase(c.in.begin(), c.in.begin() + used);
+
+    return out.empty() || send_all(c.fd, &out[0], out.size());
+}
+
+static int listen_on(int n)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0)
+        return -1;
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket_path(n).c_str(), sizeof(addr.sun_path) - 1);
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char** argv)
+{
+    struct sigaction sa, usr1;
+    int display = -1, displayfd = -1;
+    int ready_delay = 0, exit_delay = 0;
+    int listener = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == ':')
+            display = std::atoi(argv[i] + 1);
+        else if (!std::strcmp(argv[i], "-displayfd") && i + 1 < argc)
+            displayfd = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "-ready-delay") && i + 1 < argc)
+            ready_delay = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "-exit-delay") && i + 1 < argc)
+            exit_delay = std::atoi(argv[++i]);
+    }
+
+    /* like Xorg: an ignored SIGUSR1 means the parent wants to hear it */
+    sigaction(SIGUSR1, NULL, &usr1);
+
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_terminate;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    sleep_ms(ready_delay);
+
+    if (mkdir(SOCKET_DIR, 01777) == 0)
+        chmod(SOCKET_DIR, 01777);       /* past the umask */
+
+    if (display >= 0) {
+        unlink(socket_path(display).c_str());
+        listener = listen_on(display);
+    } else {
+        for (display = 0; display < 64 && listener < 0; display++) {
+            if (access(socket_path(display).c_str(), F_OK) == 0)
+                continue;
+            if ((listener = listen_on(display)) >= 0)
+                break;
+        }
+    }
+
+    if (listener < 0) {
+        std::fprintf(stderr, "stub_xserver: cannot listen on %s\n", socket_path(display).c_str());
+        return 1;
+    }
+
+    if (displayfd >= 0) {
+        char number[16];
+        int size = std::snprintf(number, sizeof(number), "%d\n", display);
+        if (write(displayfd, number, size) != size)
+            std::perror("stub_xserver: displayfd");
+        close(displayfd);
+    }
+    if (usr1.sa_handler == SIG_IGN)
+        kill(getppid(), SIGUSR1);
+
+    std::vector<client> clients;
+
+    while (!terminate) {
+        std::vector<struct pollfd> fds(clients.size() + 1);
+
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < clients.size(); i++) {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        if (poll(&fds[0], fds.size(), -1) < 0)
+            continue;
+
+        for (size_t i = clients.size(); i > 0; i--) {
+            if (fds[i].revents && !serve(clients[i - 1])) {
+                close(clients[i - 1].fd);
+                clients.erase(clients.begin() + (i - 1));
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                client c = { fd, false, 0, std::vector<unsigned char>() };
+                clients.push_back(c);
+            }
+        }
+    }
+
+    sleep_ms(exit_delay);
+
+    for (size_t i = 0; i < clients.size(); i++)
+        close(clients[i].fd);
+    close(listener);
+    unlink(socket_path(display).c_str());
+
+    return 0;
+}
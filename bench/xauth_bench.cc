@@ -0,0 +1,320 @@
+/* xauth_bench.cc
+   Benchmark for the Xau::XauthList store.
+*/
+/**
+ * @par dilithium - GPL Launcher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/**
+ * Generates Xauthority files of 10 to 100k entries and times how long
+ * XauthList takes to build, write, parse, filter and upsert them. Then
+ * forks N writers that each do the load, upsert, write cycle of
+ * make_authority against one shared file, and reports lock retries and
+ * the latency distribution of a cycle.
+ *
+ *   xauth_bench [-d dir] [-n sizes] [-w writers] [-i cycles] [-s seconds]
+ *
+ * Not built by default, use 'make bench'.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "global.h"
+#include "xauthxx.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Entry i: a local or an Internet address picked by i / 64, display
+ * i % 64, so every entry has a key of its own */
+static Xau::Xauth make_entry(size_t i, const Xau::MagicCookie& cookie)
+{
+    size_t host = i / 64;
+    unsigned short display = i % 64;
+
+    if (host % 2) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "host%lu", (unsigned long) host);
+        return Xau::Xauth(Xau::LocalAddress(std::string(name)), Xau::Display(display), cookie);
+    }
+    return Xau::Xauth(Xau::InternetAddress(10, (host >> 16) & 255, (host >> 8) & 255, host & 255),
+                      Xau::Display(display), cookie);
+}
+
+static void report(const char* what, size_t n, double seconds)
+{
+    std::printf("  %-22s %10.3f ms %14.0f /s\n", what, seconds * 1e3,
+                seconds > 0 ? n / seconds : 0.0);
+}
+
+static void bench_size(const std::string& file, size_t n)
+{
+    Xau::MagicCookie cookie;
+    double t;
+
+    std::printf("%lu entries\n", (unsigned long) n);
+
+    {
+        Xau::XauthList list;
+
+        t = now();
+        for (size_t i = 0; i < n; i++)
+            list.upsert(make_entry(i, cookie));
+        report("build (upsert new)", n, now() - t);
+
+        t = now();
+        list.write_to_file(file, false);
+        report("write", n, now() - t);
+    }
+
+    Xau::XauthList list;
+
+    t = now();
+    list.load_from_file(file, false);
+    report("parse", list.size(), now() - t);
+
+    /* one query per display, through the display index */
+    size_t found = 0;
+    t = now();
+    for (unsigned short d = 0; d < 64; d++)
+        found += list.select(Xau::XauthCond(Xau::Display(d))).size();
+    report("filter by display", 64, now() - t);
+
+    /* an address condition has no index and walks the list */
+    size_t queries = n < 64 ? n : 64;
+    t = now();
+    for (size_t i = 0; i < queries; i++)
+        found += list.select(Xau::XauthCond(*make_entry(i * (n / queries), cookie).address)).size();
+    report("filter by address", queries, now() - t);
+
+    Xau::MagicCookie fresh;
+    size_t updates = n / 10 ? n / 10 : 1;
+    t = now();
+    for (size_t i = 0; i < updates; i++)
+        list.upsert(make_entry((i * 7919) % n, fresh));
+    report("upsert existing", updates, now() - t);
+
+    if (list.size() != n)
+        std::printf("  ERROR: %lu entries after upsert, expected %lu\n",
+                    (unsigned long) list.size(), (unsigned long) n);
+
+    unlink(file.c_str());
+}
+
+/* What one writer reports to the parent for each cycle */
+struct cycle
+{
+    double latency;
+    int retries;
+    int failed;
+};
+
+/* XauthList::lock_file calls XauLockAuth(file, 3, 3, 0): up to three
+ * attempts with a sleep in between. The same policy is played out one
+ * attempt at a time here so the retries can be counted. */
+static bool counted_lock(const std::string& file, int sleep_seconds, int* retries)
+{
+    for (int attempt = 0; attempt < 3; attempt++) {
+        int status = XauLockAuth(file.c_str(), 1, 0, 0);
+        if (status == LOCK_SUCCESS)
+            return true;
+        if (status == LOCK_ERROR)
+            return false;
+        (*retries)++;
+        if (sleep_seconds)
+            sleep(sleep_seconds);
+        else
+            usleep(1000);
+    }
+    return false;
+}
+
+static void writer(const std::string& file, int id, int cycles, int sleep_seconds, int out)
+{
+    for (int i = 0; i < cycles; i++) {
+        cycle c = { 0, 0, 0 };
+        double t = now();
+
+        if (counted_lock(file, sleep_seconds, &c.retries)) {
+            try {
+                Xau::XauthList list;
+                Xau::MagicCookie cookie;
+
+                list.load_from_file(file, false);
+                list.upsert(Xau::Xauth(Xau::LocalAddress(), Xau::Display(id), cookie));
+                list.write_to_file(file, false);
+            }
+            catch (std::exception& e) {
+                c.failed = 1;
+            }
+            Xau::XauthList::unlock_file(file);
+        }
+        else
+            c.failed = 1;
+
+        c.latency = now() - t;
+        if (write(out, &c, sizeof(c)) != sizeof(c))
+            _exit(1);
+    }
+    _exit(0);
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+static void bench_contention(const std::string& file, size_t background, int writers,
+                             int cycles, int sleep_seconds)
+{
+    int fds[2];
+
+    std::printf("%d writers x %d cycles on a file of %lu entries\n",
+                writers, cycles, (unsigned long) background);
+
+    {
+        Xau::MagicCookie cookie;
+        Xau::XauthList list;
+        for (size_t i = 0; i < background; i++)
+            list.upsert(make_entry(i, cookie));
+        list.write_to_file(file, false);
+    }
+
+    if (pipe(fds) != 0) {
+        std::perror("pipe");
+        return;
+    }
+
+    double t = now();
+
+    for (int w = 0; w < writers; w++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            writer(file, 100 + w, cycles, sleep_seconds, fds[1]);
+        }
+        if (pid < 0)
+            std::perror("fork");
+    }
+    close(fds[1]);
+
+    std::vector<double> latencies;
+    long retries = 0, failed = 0, contended = 0;
+    cycle c;
+
+    while (read(fds[0], &c, sizeof(c)) == sizeof(c)) {
+        latencies.push_back(c.latency * 1e3);
+        retries += c.retries;
+        failed += c.failed;
+        contended += c.retries > 0;
+    }
+    close(fds[0]);
+
+    while (wait(NULL) > 0)
+        ;
+
+    double elapsed = now() - t;
+
+    std::sort(latencies.begin(), latencies.end());
+
+    std::printf("  cycles %lu, failed %ld, contended %ld, retries %ld, %.1f cycles/s\n",
+                (unsigned long) latencies.size(), failed, contended, retries,
+                latencies.size() / elapsed);
+    std::printf("  latency ms: p50 %.3f  p95 %.3f  p99 %.3f  max %.3f\n",
+                percentile(latencies, 0.50), percentile(latencies, 0.95),
+                percentile(latencies, 0.99),
+                latencies.empty() ? 0.0 : latencies.back());
+
+    unlink(file.c_str());
+}
+
+static void usage()
+{
+    std::fprintf(stderr,
+        "usage: xauth_bench [-d dir] [-n sizes] [-w writers] [-i cycles] [-s seconds]\n"
+        "  -d  directory for the test files, default /tmp\n"
+        "  -n  comma separated entry counts, default 10,100,1000,10000,100000\n"
+        "  -w  concurrent writers, default 8\n"
+        "  -i  load/upsert/write cycles per writer, default 50\n"
+        "  -s  seconds between lock attempts, default 3 like lock_file;\n"
+        "      0 retries after 1 ms to look at throughput alone\n");
+}
+
+int main(int argc, char* argv[])
+{
+    std::string dir = "/tmp";
+    std::string sizes = "10,100,1000,10000,100000";
+    int writers = 8, cycles = 50, sleep_seconds = 3;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:w:i:s:h")) != -1) {
+        switch (opt) {
+        case 'd': dir = optarg; break;
+        case 'n': sizes = optarg; break;
+        case 'w': writers = std::atoi(optarg); break;
+        case 'i': cycles = std::atoi(optarg); break;
+        case 's': sleep_seconds = std::atoi(optarg); break;
+        default:  usage(); return 1;
+        }
+    }
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "/xauth_bench.%d", (int) getpid());
+    std::string file = dir + name;
+
+    std::vector<size_t> counts;
+    for (char* p = std::strtok(&sizes[0], ","); p; p = std::strtok(NULL, ","))
+        counts.push_back(std::strtoul(p, NULL, 10));
+
+    try {
+        for (size_t i = 0; i < counts.size(); i++)
+            if (counts[i])
+                bench_size(file, counts[i]);
+
+        bench_contention(file, 100, writers, cycles, sleep_seconds);
+    }
+    catch (std::exception& e) {
+        std::fprintf(stderr, "xauth_bench: %s\n", e.what());
+        unlink(file.c_str());
+        return 1;
+    }
+
+    return 0;
+}
@@ -48,6 +48,7 @@
 #define DEFAULT_SERVER     "/usr/bin/X"
 #define DEFAULT_SERVER_ARG "-br -novtswitch -nolisten tcp"
 #define SERVER_BOOT_DELAY  5 /* seconds */
+#define FIRST_MAP_TIMEOUT 30 /* seconds the trace waits for the client */
 
 #ifndef PASSWD_BUFFER_SIZE
 #define PASSWD_BUFFER_SIZE 2048
@@ -128,7 +129,8 @@ public:
 
 };
 
-void Write2Log(const char* str);
+void Write2Log(const char* format, ...);
 bool set_display( Dilithium *dilithium );
+bool share_runtime_authority( Dilithium *d );
 
 #endif
@@ -8,6 +8,8 @@ extern bool  DaemonMode;
 extern bool  DropPrivileges;
 extern bool  KillX;
 extern bool  UseXinit;
+extern bool  RuntimeAuth;
+extern bool  AdaptiveTimeout;
 extern bool  Verbose;
 extern bool  DilithiumLog;
 
@@ -0,0 +1,74 @@
+/* history.h
+   Header file for the boot history of the Dilithium Program.
+*/
+/*!
+ * @par dilithium - GPL Laucher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/*!   @file    history.h Boot History
+ *    @brief   One fixed size record per run, appended to a file, with the
+ *             durations of the phases the flight recorder traced.
+ *
+ *    dilithium --stats prints the percentiles of every phase and compares
+ *    the latest boots with the ones before them, and --adaptive-timeout
+ *    sizes the wait for the X server from the boots of this machine.
+ */
+#ifndef DILITHIUM_HISTORY_H     /* Prevent double inclusion */
+#define DILITHIUM_HISTORY_H
+
+#include <stdint.h>
+
+#define DILITHIUM_HISTORYFILE  "/var/lib/dilithium/boot-history"
+
+#define HISTORY_MAGIC       0x31484c44  /* "DLH1" */
+#define HISTORY_NONE        0xffffffff  /* the phase did not happen */
+
+#define HISTORY_RECENT      10      /* boots compared with the baseline   */
+#define HISTORY_BASELINE    200     /* boots before them, the baseline    */
+#define HISTORY_MIN_BOOTS   20      /* fewer are not worth a percentile   */
+#define HISTORY_REGRESSION  125     /* percent of the baseline median     */
+#define HISTORY_NOISE       50      /* ms, smaller slow downs are ignored */
+
+enum HistoryPhase {
+    PHASE_SERVER_READY,     /* server fork to first connection      */
+    PHASE_GREETER,          /* login dialog built and painted       */
+    PHASE_AUTH,             /* password check                       */
+    PHASE_CLIENT,           /* client fork to its first window      */
+    PHASE_SHUTDOWN,         /* client and server stopped            */
+    HISTORY_PHASES
+};
+
+/* 40 bytes */
+struct history_record {
+    uint32_t magic;
+    uint32_t version;                   /* Version * 100              */
+    int64_t  time;                      /* wall clock seconds         */
+    uint32_t ms[HISTORY_PHASES];        /* or HISTORY_NONE            */
+    uint32_t reserved;
+};
+
+bool history_open (const char *filename = DILITHIUM_HISTORYFILE);
+void history_append (int version);
+
+int  history_timeout (int phase, int floor, int ceiling,
+                      const char *filename = DILITHIUM_HISTORYFILE);
+
+int  history_stats (const char *filename = DILITHIUM_HISTORYFILE);
+
+#endif
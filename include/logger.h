@@ -0,0 +1,61 @@
+/* logger.h
+   Header file for the asynchronous logger of the Dilithium Program.
+*/
+/*!
+ * @par dilithium - GPL Laucher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/*!   @file    logger.h Asynchronous Logger
+ *    @brief   Messages are formatted into a preallocated ring and written
+ *             to the log file, the syslog socket and the console by a
+ *             background thread, in batches.
+ *
+ *    A message never waits on a disk or on syslogd: when the ring is full
+ *    it is dropped and counted. Before log_start, in a forked child and
+ *    after log_stop messages are written straight away instead.
+ */
+#ifndef DILITHIUM_LOGGER_H      /* Prevent double inclusion */
+#define DILITHIUM_LOGGER_H
+
+#include <cstdarg>
+
+#define LOG_SLOTS      256      /* messages the ring holds, a power of two */
+#define LOG_TEXT_SIZE  256      /* longer messages are truncated */
+#define LOG_BATCH       64      /* messages written with one system call */
+
+/* Bit-mask values for the 'targets' argument */
+#define LOG_TO_FILE      01
+#define LOG_TO_SYSLOG    02
+#define LOG_TO_STDERR    04
+#define LOG_TO_STDOUT   010
+
+bool log_start (const char *filename);
+void log_stop (void);
+void log_flush (void);
+void log_restart (void);
+
+bool log_message (int targets, int priority, const char *ident,
+                  const char *format, ... );
+bool log_vmessage (int targets, int priority, const char *ident,
+                   const char *prefix, int ecode,
+                   const char *format, va_list args );
+
+unsigned long log_dropped (void);
+
+#endif
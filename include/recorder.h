@@ -0,0 +1,124 @@
+/* recorder.h
+   Header file for the flight recorder of the Dilithium Program.
+*/
+/*!
+ * @par dilithium - GPL Laucher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/*!   @file    recorder.h Flight Recorder
+ *    @brief   Fixed size ring of binary event records in a shared file
+ *             mapping, decoded by dilithium --dump-trace and written as
+ *             a Chrome trace by --trace-json.
+ *
+ *    A record is a handful of stores into the page cache, so it is cheap
+ *    enough to leave on all the time, and the kernel still writes the
+ *    pages out when dilithium or the X server crashes. The ring carries
+ *    on across runs, older boots are overwritten as it wraps.
+ */
+#ifndef DILITHIUM_RECORDER_H    /* Prevent double inclusion */
+#define DILITHIUM_RECORDER_H
+
+#include <stdint.h>
+
+#define DILITHIUM_TRACEFILE  "/var/log/dilithium.trace"
+
+#define TRACE_MAGIC          "DLTRACE1"
+#define TRACE_RECORDS        4096     /* records in the ring */
+#define TRACE_TAG_SIZE       16
+
+enum TraceEvent {
+    TRACE_START = 1,    /* a = wall clock seconds, b = version    */
+    TRACE_SPAWN,        /* a = child pid, tag = program           */
+    TRACE_EXEC,         /* written by the child, tag = program    */
+    TRACE_EXEC_FAILED,  /* a = errno, tag = program               */
+    TRACE_EXIT,         /* a = pid, b = wait status               */
+    TRACE_SIGNAL,       /* a = signal received                    */
+    TRACE_KILL,         /* a = pid or process group, b = signal   */
+    TRACE_STATE,        /* a = TraceState                         */
+    TRACE_READY,        /* a = 1 connected, 0 gave up, b = ms     */
+    TRACE_AUTH,         /* a = 1 authority set up, 0 failed       */
+    TRACE_LOGIN,        /* a = greeter response                   */
+    TRACE_STOP,         /* a = exit code                          */
+    TRACE_BEGIN,        /* a phase starts, tag = phase            */
+    TRACE_END,          /* a = 1 done, 0 gave up, tag = phase     */
+    TRACE_XSTATS        /* a = X requests, b = round trips, tag = scope */
+};
+
+enum TraceState {
+    STATE_BOOT = 1,
+    STATE_SERVER_STARTING,
+    STATE_SERVER_READY,
+    STATE_GREETER,
+    STATE_SESSION,
+    STATE_SHUTDOWN,
+    STATE_DAEMON
+};
+
+/* 48 bytes, a record never straddles a cache line pair */
+struct trace_record {
+    uint64_t time;                  /* CLOCK_MONOTONIC, nanoseconds      */
+    uint64_t sequence;              /* position + 1, 0 while written     */
+    uint16_t event;
+    uint16_t reserved;
+    int32_t  pid;
+    int32_t  a;
+    int32_t  b;
+    char     tag[TRACE_TAG_SIZE];
+};
+
+struct trace_header {
+    char     magic[8];
+    uint32_t record_size;
+    uint32_t records;
+    uint64_t head;                  /* records ever written              */
+};
+
+bool trace_open (const char *filename = DILITHIUM_TRACEFILE);
+void trace_close (void);
+
+void trace_event (int event, int a = 0, int b = 0, const char *tag = 0);
+void trace_event_at (uint64_t time, int event, int a = 0, int b = 0,
+                     const char *tag = 0);
+uint64_t trace_now (void);
+
+bool trace_active (void);
+
+int64_t trace_interval (const char *from, const char *to);
+bool    trace_find (int event, const char *tag, trace_record *record);
+
+int  trace_dump (const char *filename = DILITHIUM_TRACEFILE);
+int  trace_export (const char *filename = DILITHIUM_TRACEFILE);
+
+/*! A phase of the boot, from construction to the end of the scope,
+ *  for the timeline written by trace_export. */
+class trace_span
+{
+  const char *name;
+public:
+  bool done;            /* cleared when the phase gave up */
+
+  trace_span ( const char *phase ) : name ( phase ), done ( true ) {
+    trace_event ( TRACE_BEGIN, 0, 0, name );
+  }
+  ~trace_span() {
+    trace_event ( TRACE_END, done, 0, name );
+  }
+};
+
+#endif
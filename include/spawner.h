@@ -55,6 +55,9 @@ private:
   int start_server();
   int start_client();
 
+  void watch_first_map();
+  void wait_first_map();
+
   Display *xd;            /* server connection */
 
 public:
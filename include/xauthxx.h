@@ -25,9 +25,13 @@
 #define XAUTHXX_H
 
 #include <list>
+#include <map>
+#include <vector>
 #include <string>
 #include <exception>
 
+#include <sys/types.h>
+
 #include <X11/X.h>
 #include <X11/Xauth.h>
 
@@ -171,6 +175,26 @@ protected:
         : Token(data, length) {}
 };
 
+/* Source of the random bytes in a MagicCookie. The kernel is asked for
+ * POOL_SIZE bytes at a time and cookies are cut from that buffer, so a
+ * cookie costs a memcpy rather than a system call. Bytes are wiped as
+ * they are handed out, and the buffer is discarded after a fork so a
+ * parent and its child never mint the same cookie. Not thread safe. */
+class RandomPool
+{
+public:
+    enum { POOL_SIZE = 4096 };
+
+    static void get(char* buf, size_t length);
+
+private:
+    static void refill();
+
+    static unsigned char pool[POOL_SIZE];
+    static size_t available;
+    static pid_t owner;
+};
+
 class MagicCookie : public Cookie
 {
 public:
@@ -223,6 +247,7 @@ class Property
 public:
     Property() { obj = new T(); }
     Property(const T& o) { obj = o.clone(); }
+    Property(const Property<T>& p) { obj = p.obj->clone(); }
     ~Property() { delete obj; }
 
     T* operator->() { return obj; }
@@ -235,7 +260,10 @@ public:
     operator const T&() const { return *obj; }
 
     Property<T>& operator=(const T& o)
-        { delete obj; obj = o.clone(); return *this; }
+        { T* c = o.clone(); delete obj; obj = c; return *this; }
+
+    Property<T>& operator=(const Property<T>& p)
+        { return *this = *p.obj; }
 
 private:
     T* obj;
@@ -267,6 +295,7 @@ public:
 
 protected:
     ::Xauth _auth;   // used only when exporting
+    Token   _name;   // keeps the cookie name _auth points to alive
 };
 
 /******************************************************************************/
@@ -274,8 +303,12 @@ protected:
 class XauthCondAtom {
 public:
     XauthCondAtom() {}
+    virtual ~XauthCondAtom() {}
     virtual bool check(const Xau::Xauth& auth) const = 0;
     virtual XauthCondAtom* clone() const = 0;
+
+    // lets XauthList use its display index
+    virtual const Display* display() const { return 0; }
 };
 
 class XauthCondAddress : public XauthCondAtom
@@ -306,6 +339,9 @@ public:
 
     bool check(const Xau::Xauth& auth) const
         { return (*auth.display) == _display; }
+
+    const Display* display() const
+        { return &_display; }
 };
 
 class XauthCondCookie : public XauthCondAtom
@@ -347,7 +383,10 @@ public:
     XauthCond operator&&(const Display& display)   { add(display); return *this; }
     XauthCond operator&&(const Cookie& cookie)     { add(cookie);  return *this; }
 
-    bool operator()(const Xau::Xauth& auth);
+    bool operator()(const Xau::Xauth& auth) const;
+
+    // the display the condition asks for, 0 if it does not
+    const Display* display() const;
 };
 
 #define DECLARE_XAUTHCOND_ANDOP(T1,T2) \
@@ -362,19 +401,69 @@ DECLARE_XAUTHCOND_ANDOP(Cookie,Address)
 
 /******************************************************************************/
 
-class XauthList : public std::list<Xauth>
+/* Entries are kept in a vector, unique by family, address, display and
+ * cookie name, with an index on that key and another on the display, so
+ * an upsert or a display query does not walk the whole list. */
+class XauthList
 {
 public:
+    typedef std::vector<Xauth>::iterator iterator;
+    typedef std::vector<Xauth>::const_iterator const_iterator;
+
     static const std::string default_filename() { return XauFileName(); }
     static void lock_file(const std::string& filename = default_filename());
     static void unlock_file(const std::string& filename = default_filename());
 
     XauthList() {}
 
-    void load_from_file(const std::string& filename = default_filename());
-    void write_to_file(const std::string& filename = default_filename());
+    // 'lock' false is for a caller that holds the lock across a load,
+    // modify and write. A missing file loads as an empty list.
+    void load_from_file(const std::string& filename = default_filename(),
+                        bool lock = true);
+
+    // Written to a temporary file in the same directory and renamed over
+    // the old one, readers see either the old or the new file.
+    void write_to_file(const std::string& filename = default_filename(),
+                       bool lock = true);
+
+    // Adds 'auth', or replaces the entry with the same key. Returns true
+    // if the entry is new.
+    bool upsert(const Xauth& auth);
+    void push_back(const Xauth& auth) { upsert(auth); }
 
-    void remove(const XauthCond& cond) { remove_if(cond); }
+    std::vector<Xauth*> select(const XauthCond& cond);
+    void remove(const XauthCond& cond);
+
+    // Drops entries of this host whose X server is gone, returns how many
+    size_t prune_dead_displays();
+
+    iterator begin() { return entries.begin(); }
+    iterator end()   { return entries.end(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const   { return entries.end(); }
+
+    size_t size() const { return entries.size(); }
+    bool empty() const  { return entries.empty(); }
+    void clear();
+
+private:
+    struct Key
+    {
+        int         family;
+        std::string address;
+        std::string display;
+        std::string name;
+
+        Key(const Xauth& auth);
+        bool operator<(const Key& k) const;
+    };
+
+    void add(const Xauth& auth);
+    void reindex();
+
+    std::vector<Xauth> entries;
+    std::map<Key, size_t> by_key;
+    std::multimap<std::string, size_t> by_display;
 };
 
 }
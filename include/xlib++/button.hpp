@@ -32,7 +32,9 @@
 #include "color.hpp"
 #include "shapes.hpp"
 #include "window_base.hpp"
+#include "window_state.hpp"
 #include "graphics_context.hpp"
+#include "damage.hpp"
 #include "pointer.hpp"
 
 namespace xlib
@@ -54,7 +56,8 @@ namespace xlib
       m_is_down ( false ),
       m_is_mouse_over ( false ),
       m_has_focus ( false ),
-      m_rect ( rect )
+      m_rect ( rect ),
+      m_buffer ( parent.get_display() )
       {
          m_foreground      = new color ( m_display, 0, 0, 0 ); // default to Black
          m_border_color    = new color ( m_display, 0, 0, 0 ); // default to Black
@@ -95,10 +98,10 @@ namespace xlib
                         FocusChangeMask |
                         KeyPressMask |
                         KeyReleaseMask |
+                        StructureNotifyMask |
                         SubstructureNotifyMask );
 
-         XMapWindow ( m_display, m_window );
-         XFlush ( m_display );
+         m_display.map_window ( m_window, m_parent.id() );
       }
 
       virtual void on_show(){}
@@ -106,7 +109,6 @@ namespace xlib
       virtual void hide()
       {
          XUnmapWindow ( m_display, m_window );
-         XFlush ( m_display );
       }
 
       virtual void on_hide(){}
@@ -131,6 +133,12 @@ namespace xlib
             ( "could not create the command button" );
          }
 
+         /* Every pixel comes from the back buffer, so the server must not
+          * clear exposed areas first, that is what flickers. */
+         XSetWindowBackgroundPixmap ( m_display, m_window, None );
+
+         m_state.reset ( m_rect );
+
          m_parent.get_event_dispatcher().register_window ( (window_base*) this );
          set_background ( m_background );
       }
@@ -139,32 +147,22 @@ namespace xlib
       {
          if ( m_window )
          {
+            m_parent.get_event_dispatcher().unregister_window ( (window_base*) this );
+            m_display.release_drawable ( m_window );
             XDestroyWindow ( m_display, m_window );
             m_window = 0;
          }
-
-         m_parent.get_event_dispatcher().unregister_window ( (window_base*) this );
       }
 
       virtual void set_background ( color& c )
       {
          m_background.set ( c );
-
-         XSetWindowBackground ( m_display, m_window, c.pixel() );
-
-         XClearWindow ( m_display, m_window );
-
-         XFlush ( m_display );
+         refresh();
       }
       virtual void SetBackgroundColor ( short red, short green, short blue )
       {
          m_background.set_color ( red, green, blue );
-
-         XSetWindowBackground ( m_display, m_window, m_background.pixel() );
-
-         XClearWindow ( m_display, m_window );
-
-         XFlush ( m_display );
+         refresh();
       }
       virtual void SetShadowColor ( short red, short green, short blue )
       {
@@ -181,24 +179,14 @@ namespace xlib
          m_selected_color->set_color ( red, green, blue );
          refresh();
       }
+      /* answered from the shadow, see window_state.hpp */
       virtual rectangle get_rect()
       {
-         Window root;
-         int x = 0, y = 0;
-         unsigned int width = 0, height = 0, border_width = 0, depth = 0;
-         XGetGeometry ( m_display,
-                        m_window,
-                        &root,
-                        &x,
-                        &y,
-                        &width,
-                        &height,
-                        &border_width,
-                        &depth );
-
-         return rectangle ( point(0,0), width, height );
+         return m_state.area ( m_display, m_window );
       }
 
+      virtual window_state* get_state() { return &m_state; }
+
       virtual void set_focus()
       {
          XSetInputFocus ( m_display,
@@ -208,14 +196,44 @@ namespace xlib
          refresh();
       }
 
+      /* Marks the whole button dirty, it is painted once per loop turn */
       virtual void refresh ()
       {
-         XClearWindow ( m_display,
-                        m_window );
+         invalidate ( rectangle ( point(0,0), m_rect.width(), m_rect.height() ) );
+         get_event_dispatcher().schedule_paint ( this );
+      }
 
-         XFlush ( m_display );
+      virtual bool invalidate ( rectangle r )
+      {
+         m_damage.add ( r );
+         return true;
+      }
+
+      /* Draws the damaged area into the back buffer and copies just that
+       * area to the window */
+      virtual void paint()
+      {
+         if ( m_damage.empty() || ! m_window ) return;
+
+         display::scope cost ( m_display, "button::paint" );
+
+         Pixmap pm = m_buffer.get ( m_window, m_rect.width(), m_rect.height() );
+
+         if ( ! pm ) return;
+
+         graphics_context gc ( m_display, pm );
+         rectangle area = m_damage.bounds();
 
-         on_expose();
+         gc.set_clip ( m_damage.region() );
+
+         gc.set_foreground ( &m_background );
+         gc.fill_rectangle ( area );
+
+         draw ( gc );
+
+         gc.copy_area ( m_window, area );
+
+         m_damage.clear();
       }
 
 
@@ -226,14 +244,15 @@ namespace xlib
 
       virtual void on_expose()
       {
-         //m_background.set_color(197, 194, 197);
-         //set_background ( m_background );
+         invalidate ( rectangle ( point(0,0), m_rect.width(), m_rect.height() ) );
+         paint();
+      }
 
+      virtual void draw ( graphics_context& gc )
+      {
          // draw the button
          rectangle rect = get_rect();
 
-         graphics_context gc ( m_display, id() );
-
          gc.set_font(helvetica);
 
          if (m_has_focus) {
@@ -410,6 +429,7 @@ namespace xlib
       bool m_is_down, m_is_mouse_over, m_has_focus;
       std::string m_name;
       rectangle m_rect;
+      window_state m_state;
 
       color *m_foreground;
       color *m_border_color;
@@ -418,6 +438,8 @@ namespace xlib
       color *m_highlight_pressed;
       color *m_selected_color;
 
+      damage m_damage;
+      back_buffer m_buffer;
 
    };
 
@@ -25,6 +25,7 @@
 
 #include <X11/Xlib.h>
 #include "exceptions.hpp"
+#include "display.hpp"
 
 namespace xlib
 {
@@ -57,7 +58,7 @@ namespace xlib
          m_color.blue = blue * 65535 / 255;
          m_color.flags = DoRed | DoGreen | DoBlue;
 
-         if ( ! XAllocColor ( m_display, m_map, &m_color ) )
+         if ( ! m_display.alloc_color ( m_map, m_color ) )
          {
             throw create_color_exception ( "Could not create the color." );
          }
@@ -70,14 +71,7 @@ namespace xlib
 
       void free_color()
       {
-         unsigned long pixels[2];
-         pixels[0] = pixel();
-
-         XFreeColors ( m_display,
-                       m_map,
-                       pixels,
-                       1,
-                       0 );
+         m_display.free_color ( m_map, pixel() );
       }
 
    public:
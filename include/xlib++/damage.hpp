@@ -0,0 +1,164 @@
+/* damage.hpp
+   definition of the xlib::damage and xlib::back_buffer classes
+*/
+/**
+ * @par xlib++ - X Low level Widget Routines
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This file was added to Rob Tougher's <robt@robtougher.com> collection
+ * of c++ classes for creating widgets using low level X routines, i.e.
+ * no dependencies on the G or K lib's.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+
+#ifndef _xlib_damage_class_
+#define _xlib_damage_class_
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include "display.hpp"
+#include "shapes.hpp"
+
+namespace xlib
+{
+   /*!
+    * \class damage
+    *
+    * \brief The part of a widget that has to be repainted.
+    *
+    * Rectangles are merged into a client side X Region, so any number of
+    * state changes and Expose fragments collapse into one repaint.
+    */
+   class damage
+   {
+   public:
+
+      damage() { m_region = XCreateRegion(); }
+      ~damage() { XDestroyRegion ( m_region ); }
+
+      void add ( rectangle r )
+      {
+         XRectangle xr;
+
+         if ( r.width() <= 0 || r.height() <= 0 ) return;
+
+         xr.x      = r.origin().x();
+         xr.y      = r.origin().y();
+         xr.width  = r.width();
+         xr.height = r.height();
+
+         XUnionRectWithRegion ( &xr, m_region, m_region );
+      }
+
+      bool empty() { return XEmptyRegion ( m_region ); }
+
+      rectangle bounds()
+      {
+         XRectangle box;
+
+         XClipBox ( m_region, &box );
+
+         return rectangle ( point ( box.x, box.y ), box.width, box.height );
+      }
+
+      Region region() { return m_region; }
+
+      void clear()
+      {
+         XDestroyRegion ( m_region );
+         m_region = XCreateRegion();
+      }
+
+   private:
+
+      /* Not copyable */
+      damage ( const damage& );
+      void operator = ( damage& );
+
+      Region m_region;
+   };
+
+   /*!
+    * \class back_buffer
+    *
+    * \brief Offscreen Pixmap a widget paints into before it is shown.
+    *
+    * The pixmap is created the first time it is needed, with the depth
+    * of the window it belongs to, and kept for the life of the widget.
+    */
+   class back_buffer
+   {
+   public:
+
+      back_buffer ( display& d )
+      : m_display ( d ), m_pixmap ( 0 ), m_width ( 0 ), m_height ( 0 ) {}
+
+      ~back_buffer() { release(); }
+
+      Pixmap get ( Window w, int width, int height )
+      {
+         if ( m_pixmap && width == m_width && height == m_height )
+         {
+            return m_pixmap;
+         }
+
+         release();
+
+         XWindowAttributes attr;
+
+         if ( ! XGetWindowAttributes ( m_display, w, &attr ) )
+         {
+            return 0;
+         }
+
+         m_pixmap = XCreatePixmap ( m_display, w, width, height, attr.depth );
+         m_width  = width;
+         m_height = height;
+
+#ifdef HAVE_XFT
+         m_display.get_text_renderer().bind ( m_pixmap,
+                                              attr.visual,
+                                              attr.colormap );
+#endif
+         return m_pixmap;
+      }
+
+      void release()
+      {
+         if ( m_pixmap )
+         {
+            m_display.release_drawable ( m_pixmap );
+            XFreePixmap ( m_display, m_pixmap );
+            m_pixmap = 0;
+         }
+      }
+
+   private:
+
+      /* Not copyable */
+      back_buffer ( const back_buffer& );
+      void operator = ( back_buffer& );
+
+      display& m_display;
+      Pixmap m_pixmap;
+      int m_width, m_height;
+   };
+
+};
+
+#endif
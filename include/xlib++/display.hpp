@@ -29,16 +29,83 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <vector>
 #include <X11/Xlib.h>
 #include "exceptions.hpp"
+#include "font_metrics.hpp"
+#include "text_renderer.hpp"
+#include <X11/Xlibint.h>
+
+/* Xlibint.h defines these as macros, they break <algorithm> */
+#undef min
+#undef max
 
 namespace xlib
 {
+   /*!
+    * \brief Output counters of a display, see display::frame_stats.
+    *
+    * 'flushes' counts display::flush calls, 'writes' the number of times
+    * Xlib handed its request buffer to the socket, i.e. write syscalls,
+    * whoever caused them (a flush, a full buffer or a round trip).
+    * 'requests' is taken from the request sequence number, and
+    * 'round_trips' counts the writes that were neither a display::flush
+    * nor a buffer at least half full, which is Xlib sending a request
+    * whose reply it is about to wait for.
+    */
+   struct flush_stats
+   {
+      unsigned long flushes;
+      unsigned long writes;
+      unsigned long bytes;
+      unsigned long requests;
+      unsigned long round_trips;
+
+      flush_stats() : flushes ( 0 ), writes ( 0 ), bytes ( 0 ),
+                      requests ( 0 ), round_trips ( 0 ) {}
+
+      void add ( const flush_stats& s )
+      {
+         flushes     += s.flushes;
+         writes      += s.writes;
+         bytes       += s.bytes;
+         requests    += s.requests;
+         round_trips += s.round_trips;
+      }
+
+      /* The counters since 'earlier', a copy of the same totals */
+      flush_stats since ( const flush_stats& earlier ) const
+      {
+         flush_stats s;
+
+         s.flushes     = flushes - earlier.flushes;
+         s.writes      = writes - earlier.writes;
+         s.bytes       = bytes - earlier.bytes;
+         s.requests    = requests - earlier.requests;
+         s.round_trips = round_trips - earlier.round_trips;
+
+         return s;
+      }
+   };
+
+   /* What a named piece of code cost over all the times it ran */
+   struct scope_stats
+   {
+      unsigned long calls;
+      flush_stats cost;
+
+      scope_stats() : calls ( 0 ) {}
+   };
 
    class display
    {
    public:
-      display ( std::string name )
+      display ( std::string name ) : m_default_font ( 0 ),
+      m_map_parent ( 0 ), m_flushing ( false ), m_frames ( 0 )
+#ifdef HAVE_XFT
+      , m_text_renderer ( 0 )
+#endif
       {
          m_display = XOpenDisplay ( name.c_str() );
 
@@ -48,12 +115,19 @@ namespace xlib
             ost << "Could not open display '" << name << "'. Is X server running?";
             throw open_display_exception ( ost.str() );
          }
+
+         watch_output();
+         m_frame_request = NextRequest ( m_display );
+         inspect_visual();
+         prefetch_atoms();
       }
 
       ~display()
       {
          if ( m_display )
          {
+            instances().erase ( m_display );
+            free_fonts();
             XCloseDisplay ( m_display );
             m_display = 0;
          }
@@ -69,9 +143,357 @@ namespace xlib
       }
       operator Display*() { return m_display; }
 
+      /* Returns the metrics of the font called 'name', loading it from the
+       * server only the first time it is asked for on this display. A font
+       * that could not be loaded is remembered too, so the server font path
+       * is not scanned again. Returns 0 in that case. */
+      font_metrics* get_font ( const std::string& name )
+      {
+         std::map<std::string, font_metrics*>::iterator it = m_fonts.find ( name );
+
+         if ( it != m_fonts.end() )
+         {
+            return it->second;
+         }
+
+         font_metrics* metrics = 0;
+         XFontStruct* fs = XLoadQueryFont ( m_display, name.c_str() );
+
+         if ( fs )
+         {
+            metrics = new font_metrics ( m_display, fs, true );
+         }
+
+         m_fonts[name] = metrics;
+
+         return metrics;
+      }
+
+      /* Metrics of the font a new GC starts out with, queried once */
+      font_metrics* get_default_font ( GC gc )
+      {
+         if ( ! m_default_font )
+         {
+            XFontStruct* fs = XQueryFont ( m_display, XGContextFromGC ( gc ) );
+
+            if ( fs )
+            {
+               m_default_font = new font_metrics ( m_display, fs, false );
+            }
+         }
+
+         return m_default_font;
+      }
+
+#ifdef HAVE_XFT
+      text_renderer& get_text_renderer()
+      {
+         if ( ! m_text_renderer )
+         {
+            m_text_renderer = new text_renderer ( m_display );
+         }
+         return *m_text_renderer;
+      }
+#endif
+
+      /* Drops anything cached for a window that is being destroyed */
+      void release_drawable ( Drawable d )
+      {
+#ifdef HAVE_XFT
+         if ( m_text_renderer )
+         {
+            m_text_renderer->release ( d );
+         }
+#endif
+      }
+
+      /* XAllocColor costs a round trip per color, and each widget makes
+       * several. On a TrueColor visual the pixel follows from the channel
+       * masks, so for the default colormap it is computed here, rounded
+       * the way the server would, and no request is sent at all. */
+      bool alloc_color ( Colormap map, XColor& c )
+      {
+         if ( ! m_true_color || map != DefaultColormap ( m_display, 0 ) )
+         {
+            return XAllocColor ( m_display, map, &c );
+         }
+
+         c.pixel = channel ( c.red, m_channels[0] ) |
+                   channel ( c.green, m_channels[1] ) |
+                   channel ( c.blue, m_channels[2] );
+
+         return true;
+      }
+
+      void free_color ( Colormap map, unsigned long pixel )
+      {
+         if ( ! m_true_color || map != DefaultColormap ( m_display, 0 ) )
+         {
+            XFreeColors ( m_display, map, &pixel, 1, 0 );
+         }
+      }
+
+      /* Widgets never flush. Requests pile up in the Xlib buffer while an
+       * event loop turn is handled and go out here, once, before the loop
+       * blocks; see event_dispatcher::run. */
+      void flush()
+      {
+         m_frame.flushes++;
+         m_flushing = true;
+         XFlush ( m_display );
+         m_flushing = false;
+      }
+
+      /* Closes the current frame: flushes, and moves its counters to the
+       * totals. frame_stats() then describes the frame just finished. */
+      void end_frame()
+      {
+         flush();
+
+         m_frame.requests = NextRequest ( m_display ) - m_frame_request;
+         m_frame_request  = NextRequest ( m_display );
+
+         m_last_frame = m_frame;
+         m_total.add ( m_frame );
+         m_frame = flush_stats();
+         m_frames++;
+      }
+
+      const flush_stats& frame_stats() { return m_last_frame; }
+
+      /* Everything since the display was opened, including the current
+       * frame, which has not been ended yet */
+      flush_stats total_stats()
+      {
+         flush_stats s = m_total;
+         s.add ( m_frame );
+         s.requests += NextRequest ( m_display ) - m_frame_request;
+         return s;
+      }
+
+      unsigned long frames() { return m_frames; }
+
+      /* Everything sent between begin_scope and the matching end_scope
+       * is added to scope_report()[name], as well as to the scopes it is
+       * nested in. 'name' must outlive the display, a literal does. */
+      void begin_scope ( const char* name )
+      {
+         m_scope_stack.push_back ( std::make_pair ( name, total_stats() ) );
+      }
+
+      void end_scope()
+      {
+         if ( m_scope_stack.empty() ) return;
+
+         scope_stats& s = m_scopes[m_scope_stack.back().first];
+
+         s.calls++;
+         s.cost.add ( total_stats().since ( m_scope_stack.back().second ) );
+
+         m_scope_stack.pop_back();
+      }
+
+      const std::map<std::string, scope_stats>& scope_report()
+      {
+         return m_scopes;
+      }
+
+      /* begin_scope and end_scope around a block */
+      class scope
+      {
+      public:
+         scope ( display& d, const char* name ) : m_d ( d )
+         {
+            m_d.begin_scope ( name );
+         }
+         ~scope() { m_d.end_scope(); }
+      private:
+         display& m_d;
+      };
+
+      /* Children of 'parent' created between begin_map_batch and
+       * end_map_batch are mapped by a single XMapSubwindows instead of one
+       * XMapWindow each. Nothing is visible until end_map_batch, so input
+       * focus must not be set on them before it. */
+      void begin_map_batch ( Window parent )
+      {
+         m_map_parent = parent;
+      }
+
+      void end_map_batch()
+      {
+         if ( m_map_parent )
+         {
+            XMapSubwindows ( m_display, m_map_parent );
+            m_map_parent = 0;
+         }
+      }
+
+      void map_window ( Window w, Window parent )
+      {
+         if ( ! m_map_parent || parent != m_map_parent )
+         {
+            XMapWindow ( m_display, w );
+         }
+      }
+
    private:
 
+      struct color_channel
+      {
+         int shift;
+         int bits;
+      };
+
+      /* Also stores the value the color really gets, as XAllocColor does */
+      static unsigned long channel ( unsigned short& value,
+                                     const color_channel& ch )
+      {
+         unsigned long max = ( 1UL << ch.bits ) - 1;
+         unsigned long v = ( value * max + 32767 ) / 65535;
+
+         value = v * 65535 / max;
+
+         return v << ch.shift;
+      }
+
+      void inspect_visual()
+      {
+         Visual* v = DefaultVisual ( m_display, 0 );
+         unsigned long masks[3];
+
+         m_true_color = ( v->c_class == TrueColor );
+
+         masks[0] = v->red_mask;
+         masks[1] = v->green_mask;
+         masks[2] = v->blue_mask;
+
+         for ( int i = 0; i < 3 && m_true_color; i++ )
+         {
+            unsigned long m = masks[i];
+
+            m_channels[i].shift = 0;
+            m_channels[i].bits  = 0;
+
+            if ( ! m )
+            {
+               m_true_color = false;
+               break;
+            }
+
+            while ( ! ( m & 1 ) )
+            {
+               m >>= 1;
+               m_channels[i].shift++;
+            }
+            while ( m & 1 )
+            {
+               m >>= 1;
+               m_channels[i].bits++;
+            }
+         }
+      }
+
+      /* Interns every atom xlib++ uses with one XInternAtoms, a single
+       * round trip. Xlib keeps them in its atom cache, so the later
+       * XInternAtom and XSetWMProtocols calls are answered locally. */
+      void prefetch_atoms()
+      {
+         char* names[] = { (char*) "WM_PROTOCOLS",
+                           (char*) "WM_DELETE_WINDOW" };
+         Atom atoms[2];
+
+         XInternAtoms ( m_display, names, 2, False, atoms );
+      }
+
+      /* Xlib calls this with its output buffer every time it is about to
+       * be written to the connection, and once more with the extra data
+       * of the request that caused the write, if any. */
+      static void before_flush ( Display* d, XExtCodes* codes,
+                                 const char* data, long len )
+      {
+         std::map<Display*, display*>::iterator it = instances().find ( d );
+
+         if ( it == instances().end() ) return;
+
+         flush_stats& s = it->second->m_frame;
+
+         if ( data == d->buffer )
+         {
+            s.writes++;
+
+            if ( ! it->second->m_flushing &&
+                 len < ( d->bufmax - d->buffer ) / 2 )
+            {
+               s.round_trips++;
+            }
+         }
+         s.bytes += len;
+      }
+
+      /* A private extension number is enough to get the flush hook, the
+       * server never hears of it */
+      void watch_output()
+      {
+         XExtCodes* codes = XAddExtension ( m_display );
+
+         if ( codes )
+         {
+            instances()[m_display] = this;
+            XESetBeforeFlush ( m_display, codes->extension, before_flush );
+         }
+      }
+
+      static std::map<Display*, display*>& instances()
+      {
+         static std::map<Display*, display*> displays;
+         return displays;
+      }
+
+      void free_fonts()
+      {
+         std::map<std::string, font_metrics*>::iterator it;
+
+         for ( it = m_fonts.begin(); it != m_fonts.end(); it++ )
+         {
+            delete it->second;
+         }
+
+         m_fonts.clear();
+
+         delete m_default_font;
+         m_default_font = 0;
+
+#ifdef HAVE_XFT
+         delete m_text_renderer;
+         m_text_renderer = 0;
+#endif
+      }
+
       Display* m_display;
+
+      std::map<std::string, font_metrics*> m_fonts;
+      font_metrics* m_default_font;
+
+      Window m_map_parent;
+
+      bool m_true_color;
+      color_channel m_channels[3];
+
+      bool m_flushing;
+
+      flush_stats m_frame;
+      flush_stats m_last_frame;
+      flush_stats m_total;
+      unsigned long m_frames;
+      unsigned long m_frame_request;
+
+      std::vector<std::pair<const char*, flush_stats> > m_scope_stack;
+      std::map<std::string, scope_stats> m_scopes;
+
+#ifdef HAVE_XFT
+      text_renderer* m_text_renderer;
+#endif
    };
 };
 
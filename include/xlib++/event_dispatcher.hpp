@@ -29,35 +29,20 @@
 #include <X11/Xlib.h>
 #include <X11/keysym.h>
 #include <X11/Xutil.h>
+#include <X11/Xresource.h>
 #include "display.hpp"
 #include <vector>
+#include <map>
+#include <poll.h>
 #include <algorithm>
 #include "window_base.hpp"
+#include "window_state.hpp"
+#include "timer_wheel.hpp"
 #include "character.hpp"
 
 namespace xlib
 {
 
-   class find_window
-   {
-   public:
-
-      find_window ( Window w, window_base** p ) : m_w ( w ), m_p ( p ){};
-      ~find_window(){};
-
-      void operator () ( window_base* p )
-      {
-         if ( p && p->id() == (long)m_w )
-         {
-            *m_p = p;
-         }
-      }
-
-   private:
-      Window m_w;
-      window_base** m_p;
-   };
-
    class remove_window
    {
    public:
@@ -73,10 +58,21 @@ namespace xlib
 
    };
 
+   /*! \brief Implemented by anything that watches a file descriptor */
+   class fd_handler
+   {
+   public:
+      virtual ~fd_handler() {}
+      virtual void on_fd_ready ( int fd, short revents ) = 0;
+   };
+
    class event_dispatcher
    {
    public:
-      event_dispatcher ( display& d  ) : m_run ( true ), m_display ( d ){}
+      event_dispatcher ( display& d  ) : m_run ( true ), m_display ( d )
+      {
+         m_context = XUniqueContext();
+      }
       ~event_dispatcher(){}
 
       void initialize ( display& d  )
@@ -85,43 +81,150 @@ namespace xlib
          m_run = true;
       }
 
+      /* Widgets are found through an XContext, Xlib's hash table keyed by
+       * window ID, so the cost of dispatching an event does not depend on
+       * the number of widgets. A widget must be registered after its
+       * window is created and unregistered before it is destroyed. */
       void register_window ( window_base* p )
       {
-         if ( ! p ) return;
+         if ( ! p || ! p->id() ) return;
 
-         if ( std::find ( m_windows.begin(),
-            m_windows.end(), p ) == m_windows.end() )
-         {
-            m_windows.push_back ( p );
-         }
+         XSaveContext ( m_display, p->id(), m_context, (XPointer) p );
       }
 
       void unregister_window ( window_base* p )
       {
          if ( ! p ) return;
 
+         if ( p->id() && lookup ( p->id() ) == p )
+         {
+            XDeleteContext ( m_display, p->id(), m_context );
+         }
+
          std::vector<window_base*>::iterator it =
-         std::remove_if ( m_windows.begin(),
-                          m_windows.end(),
+         std::remove_if ( m_dirty.begin(),
+                          m_dirty.end(),
                           remove_window ( p ) );
 
-         m_windows.erase ( it, m_windows.end() );
+         m_dirty.erase ( it, m_dirty.end() );
+
+      }
+
+      window_base* lookup ( Window w )
+      {
+         XPointer p = 0;
+
+         if ( XFindContext ( m_display, w, m_context, &p ) != 0 )
+         {
+            return 0;
+         }
+
+         return (window_base*) p;
+      }
+
+      /* Queues a widget for paint_dirty(). Any number of calls before the
+       * loop comes around again result in a single repaint. */
+      void schedule_paint ( window_base* p )
+      {
+         if ( ! p ) return;
+
+         if ( std::find ( m_dirty.begin(),
+            m_dirty.end(), p ) == m_dirty.end() )
+         {
+            m_dirty.push_back ( p );
+         }
+      }
 
+      void paint_dirty()
+      {
+         std::vector<window_base*> dirty;
+
+         dirty.swap ( m_dirty );
+
+         for ( std::vector<window_base*>::iterator it = dirty.begin();
+               it != dirty.end(); it++ )
+         {
+            (*it)->paint();
+         }
       }
 
+      /* One poll() covers the X connection, the watched descriptors and
+       * the next timer, so the loop sleeps until there is real work. */
       void run()
       {
          m_run = true;
 
-         XEvent report;
-
          while ( m_run )
          {
-            XNextEvent ( m_display, &report );
-            handle_event ( report );
+            /* Only paint once the queue is drained, so everything that
+             * happened during this turn is blitted in one go, then send
+             * all of it with one flush before blocking. XPending would
+             * flush on every call, QueuedAfterReading does not. */
+            if ( ! XEventsQueued ( m_display, QueuedAfterReading ) )
+            {
+               paint_dirty();
+               m_display.end_frame();
+
+               wait();
+            }
+
+            m_timers.advance();
+
+            if ( ! m_run ) break;
+
+            if ( ! XEventsQueued ( m_display, QueuedAfterReading ) )
+            {
+               continue;
+            }
+
+            read_batch();
+
+            for ( std::vector<XEvent>::iterator it = m_batch.begin();
+                  it != m_batch.end() && m_run; it++ )
+            {
+               m_stats.dispatched++;
+               handle_event ( *it );
+            }
          }
       }
 
+      /* Timers, see timer_wheel.hpp. Cursor blink, idle blanking and
+       * authentication timeouts run from here. */
+      int add_timer ( unsigned int ms, timer_handler* h, bool repeat = false )
+      {
+         return m_timers.add ( ms, h, repeat );
+      }
+
+      void cancel_timer ( int id ) { m_timers.cancel ( id ); }
+
+      /* Any pollable descriptor: an eventfd a worker thread signals, a
+       * signalfd, a timerfd, a pipe to the supervisor. 'events' takes
+       * POLLIN/POLLOUT, the handler gets the revents poll() returned. */
+      void watch_fd ( int fd, short events, fd_handler* h )
+      {
+         fd_watch w;
+
+         w.events  = events;
+         w.handler = h;
+
+         m_fds[fd] = w;
+      }
+
+      void unwatch_fd ( int fd ) { m_fds.erase ( fd ); }
+
+      /* Events read from the server and events handed to widgets, the
+       * difference is what compression saved */
+      struct event_stats
+      {
+         unsigned long raw;
+         unsigned long dispatched;
+         unsigned long batches;
+
+         event_stats() : raw ( 0 ), dispatched ( 0 ), batches ( 0 ) {}
+      };
+
+      const event_stats& get_event_stats() { return m_stats; }
+
       void stop()
       {
          m_run = false;
@@ -130,12 +233,9 @@ namespace xlib
       bool handle_event ( XEvent& report )
       {
 
-         window_base* p = 0;
-
-         std::for_each ( m_windows.begin(),
-                         m_windows.end(),
-                         find_window ( report.xany.window, &p ) );
+         track_state ( report );
 
+         window_base* p = lookup ( report.xany.window );
 
          if ( p )
          {
@@ -143,7 +243,20 @@ namespace xlib
             {
                case Expose:
                {
-                  p->on_expose();
+                  rectangle area ( point ( report.xexpose.x,
+                                           report.xexpose.y ),
+                                   report.xexpose.width,
+                                   report.xexpose.height );
+
+                  if ( p->invalidate ( area ) )
+                  {
+                     schedule_paint ( p );
+                  }
+                  else if ( report.xexpose.count == 0 )
+                  {
+                     /* the last of the series, redraw once */
+                     p->on_expose();
+                  }
                   break;
                }
                case ButtonPress:
@@ -271,7 +384,164 @@ namespace xlib
 
    private:
 
-      std::vector<window_base*> m_windows;
+      struct fd_watch
+      {
+         short events;
+         fd_handler* handler;
+      };
+
+      void wait()
+      {
+         std::vector<struct pollfd> fds;
+         std::map<int, fd_watch>::iterator it;
+         struct pollfd pfd;
+
+         pfd.fd      = ConnectionNumber ( m_display.get() );
+         pfd.events  = POLLIN;
+         pfd.revents = 0;
+         fds.push_back ( pfd );
+
+         for ( it = m_fds.begin(); it != m_fds.end(); it++ )
+         {
+            pfd.fd     = it->first;
+            pfd.events = it->second.events;
+            fds.push_back ( pfd );
+         }
+
+         if ( poll ( &fds[0], fds.size(), m_timers.timeout() ) <= 0 )
+         {
+            return; /* timeout, or EINTR from a signal */
+         }
+
+         /* handlers may watch or unwatch, look each one up again */
+         for ( std::vector<struct pollfd>::size_type i = 1; i < fds.size(); i++ )
+         {
+            if ( ! fds[i].revents ) continue;
+
+            it = m_fds.find ( fds[i].fd );
+
+            if ( it != m_fds.end() )
+            {
+               it->second.handler->on_fd_ready ( fds[i].fd, fds[i].revents );
+            }
+         }
+      }
+
+      /* Takes every event that has already arrived. A run of MotionNotify for the same window keeps only the
+       * last position, and all Expose fragments of a window are merged
+       * into the first one, whose rectangle grows to cover them. */
+      void read_batch()
+      {
+         XEvent report;
+         std::map<Window, std::vector<XEvent>::size_type> exposed;
+
+         m_batch.clear();
+
+         do
+         {
+            XNextEvent ( m_display, &report );
+            m_stats.raw++;
+
+            if ( report.type == MotionNotify && ! m_batch.empty() )
+            {
+               XEvent& last = m_batch.back();
+
+               if ( last.type == MotionNotify &&
+                    last.xmotion.window == report.xmotion.window &&
+                    last.xmotion.state == report.xmotion.state )
+               {
+                  last = report;
+                  continue;
+               }
+            }
+            else if ( report.type == Expose )
+            {
+               std::map<Window, std::vector<XEvent>::size_type>::iterator it =
+               exposed.find ( report.xexpose.window );
+
+               if ( it != exposed.end() )
+               {
+                  merge_expose ( m_batch[it->second].xexpose,
+                                 report.xexpose );
+                  continue;
+               }
+
+               exposed[report.xexpose.window] = m_batch.size();
+               report.xexpose.count = 0;
+            }
+
+            m_batch.push_back ( report );
+         }
+         while ( XEventsQueued ( m_display, QueuedAfterReading ) );
+
+         m_stats.batches++;
+      }
+
+      static void merge_expose ( XExposeEvent& into, const XExposeEvent& e )
+      {
+         int x1 = std::min ( into.x, e.x );
+         int y1 = std::min ( into.y, e.y );
+         int x2 = std::max ( into.x + into.width, e.x + e.width );
+         int y2 = std::max ( into.y + into.height, e.y + e.height );
+
+         into.x      = x1;
+         into.y      = y1;
+         into.width  = x2 - x1;
+         into.height = y2 - y1;
+      }
+
+      window_state* state_of ( Window w )
+      {
+         window_base* p = lookup ( w );
+
+         return p ? p->get_state() : 0;
+      }
+
+      /* Keeps the window_state shadows current. Structure events name the
+       * window they are about, which is not the window they were reported
+       * to when they come from a parent's SubstructureNotifyMask. */
+      void track_state ( XEvent& report )
+      {
+         window_state* s = 0;
+
+         switch ( report.type )
+         {
+            case ConfigureNotify:
+               if ( ( s = state_of ( report.xconfigure.window ) ) )
+               {
+                  s->configure ( report.xconfigure );
+               }
+               break;
+            case MapNotify:
+               if ( ( s = state_of ( report.xmap.window ) ) )
+               {
+                  s->set_mapped ( true );
+               }
+               break;
+            case UnmapNotify:
+               if ( ( s = state_of ( report.xunmap.window ) ) )
+               {
+                  s->set_mapped ( false );
+               }
+               break;
+            case FocusIn:
+            case FocusOut:
+               /* NotifyPointer only says where the pointer is */
+               if ( report.xfocus.detail != NotifyPointer &&
+                    ( s = state_of ( report.xfocus.window ) ) )
+               {
+                  s->set_focused ( report.type == FocusIn );
+               }
+               break;
+         }
+      }
+
+      XContext m_context;
+      std::vector<window_base*> m_dirty;
+      std::vector<XEvent> m_batch;
+      event_stats m_stats;
+      timer_wheel m_timers;
+      std::map<int, fd_watch> m_fds;
       display& m_display;
       bool m_run;
 
@@ -0,0 +1,223 @@
+/* font_metrics.hpp
+   definition of the xlib::font_metrics class
+*/
+/**
+ * @par xlib++ - X Low level Widget Routines
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This file was added to Rob Tougher's <robt@robtougher.com> collection
+ * of c++ classes for creating widgets using low level X routines, i.e.
+ * no dependencies on the G or K lib's.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+
+#ifndef _xlib_font_metrics_class_
+#define _xlib_font_metrics_class_
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <X11/Xlib.h>
+
+namespace xlib
+{
+   /*!
+    * \class font_metrics
+    *
+    * \brief Client side copy of the metrics of one X font.
+    *
+    * The XFontStruct is obtained from the server exactly once, when the
+    * font is first requested from the display, and the per-glyph data is
+    * flattened into tables indexed by the 8 bit character code. Widths,
+    * extents and heights are then answered locally; no round trip is made
+    * while a widget is repainted or a key is typed. Instances are owned by
+    * xlib::display, see display::get_font.
+    */
+   class font_metrics
+   {
+   public:
+
+      /* 'loaded' is true when the font came from XLoadQueryFont and must be
+       * unloaded, false when it was only queried, i.e. the GC default font */
+      font_metrics ( Display* d, XFontStruct* fs, bool loaded )
+      : m_display ( d ), m_font ( fs ), m_loaded ( loaded )
+      {
+         XCharStruct *def = lookup ( fs->default_char, 0 );
+
+         for ( int c = 0; c < 256; c++ )
+         {
+            XCharStruct *cs = lookup ( c, def );
+
+            if ( cs )
+            {
+               m_chars[c] = *cs;
+               m_exists[c] = true;
+            }
+            else
+            {
+               std::memset ( &m_chars[c], 0, sizeof(XCharStruct) );
+               m_exists[c] = false;
+            }
+
+            m_widths[c] = m_chars[c].width;
+         }
+      }
+
+      ~font_metrics()
+      {
+         if ( m_loaded )
+         {
+            XFreeFont ( m_display, m_font );
+         }
+         else
+         {
+            XFreeFontInfo ( 0, m_font, 1 );
+         }
+      }
+
+      Font fid() { return m_font->fid; }
+
+      XFontStruct* get() { return m_font; }
+
+      int char_width ( unsigned char c ) { return m_widths[c]; }
+
+      /*! \brief Local replacement for XTextWidth */
+      int text_width ( const std::string& text )
+      {
+         int width = 0;
+
+         for ( std::string::size_type i = 0; i < text.size(); i++ )
+         {
+            width += m_widths[(unsigned char) text[i]];
+         }
+
+         return width;
+      }
+
+      std::vector<int> char_widths ( const std::string& text )
+      {
+         std::vector<int> widths;
+
+         widths.reserve ( text.size() );
+
+         for ( std::string::size_type i = 0; i < text.size(); i++ )
+         {
+            widths.push_back ( m_widths[(unsigned char) text[i]] );
+         }
+
+         return widths;
+      }
+
+      /*! \brief Local replacement for XTextExtents/XQueryTextExtents */
+      void text_extents ( const std::string& text, XCharStruct *overall )
+      {
+         bool first = true;
+         int x = 0;
+
+         std::memset ( overall, 0, sizeof(XCharStruct) );
+
+         for ( std::string::size_type i = 0; i < text.size(); i++ )
+         {
+            unsigned char c = text[i];
+
+            if ( ! m_exists[c] ) continue;
+
+            XCharStruct& cs = m_chars[c];
+
+            if ( first )
+            {
+               overall->lbearing = cs.lbearing;
+               overall->rbearing = cs.rbearing;
+               overall->ascent   = cs.ascent;
+               overall->descent  = cs.descent;
+               first = false;
+            }
+            else
+            {
+               if ( x + cs.lbearing < overall->lbearing )
+                  overall->lbearing = x + cs.lbearing;
+               if ( x + cs.rbearing > overall->rbearing )
+                  overall->rbearing = x + cs.rbearing;
+               if ( cs.ascent > overall->ascent )
+                  overall->ascent = cs.ascent;
+               if ( cs.descent > overall->descent )
+                  overall->descent = cs.descent;
+            }
+
+            x += cs.width;
+         }
+
+         overall->width = x;
+      }
+
+      int ascent()  { return m_font->ascent; }
+      int descent() { return m_font->descent; }
+
+      /* same value get_text_height used to compute from XQueryFont */
+      int height()
+      {
+         return m_font->max_bounds.ascent + m_font->max_bounds.descent;
+      }
+
+   private:
+
+      /* Mirrors CI_GET_CHAR_INFO_1D in Xlib's XTextExt.c, so the cached
+       * values are the ones XTextWidth would have computed. */
+      XCharStruct* lookup ( unsigned int col, XCharStruct* def )
+      {
+         XCharStruct *cs = def;
+
+         if ( col >= m_font->min_char_or_byte2 &&
+              col <= m_font->max_char_or_byte2 )
+         {
+            if ( m_font->per_char == NULL )
+            {
+               cs = &m_font->min_bounds;
+            }
+            else
+            {
+               cs = &m_font->per_char[col - m_font->min_char_or_byte2];
+
+               if ( cs->width == 0 && cs->lbearing == 0 &&
+                    cs->rbearing == 0 && cs->ascent == 0 &&
+                    cs->descent == 0 )
+               {
+                  cs = def;
+               }
+            }
+         }
+
+         return cs;
+      }
+
+      /* Not copyable */
+      font_metrics ( const font_metrics& );
+      void operator = ( font_metrics& );
+
+      Display* m_display;
+      XFontStruct* m_font;
+      bool m_loaded;
+
+      XCharStruct m_chars[256];
+      bool m_exists[256];
+      int m_widths[256];
+   };
+
+};
+
+#endif
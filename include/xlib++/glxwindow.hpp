@@ -31,8 +31,10 @@
 
 #include <string>
 #include <sstream>
+#include <dlfcn.h>
 
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #include <X11/extensions/Xrender.h>
 
 #include <GL/gl.h>
@@ -40,6 +42,7 @@
 
 #include "display.hpp"
 #include "window_base.hpp"
+#include "window_state.hpp"
 #include "event_dispatcher.hpp"
 #include "color.hpp"
 #include "shapes.hpp"
@@ -73,20 +76,88 @@ namespace xlib
      None
    };
 
+   /*!
+    * \class glx_library
+    *
+    * \brief The GLX entry points glxwindow uses, resolved from libGL
+    *        the first time a window asks for GL.
+    *
+    * The binary does not link libGL, so a greeter that draws with plain X
+    * and XRender never loads Mesa. get() returns 0 if libGL is missing.
+    */
+   class glx_library
+   {
+   public:
+
+      typedef GLXFBConfig* (*choose_fbconfig_fn) ( Display*, int,
+                                                   const int*, int* );
+      typedef XVisualInfo* (*visual_from_fbconfig_fn) ( Display*,
+                                                        GLXFBConfig );
+      typedef GLXWindow (*create_window_fn) ( Display*, GLXFBConfig,
+                                              Window, const int* );
+      typedef void (*destroy_window_fn) ( Display*, GLXWindow );
+
+      choose_fbconfig_fn      choose_fbconfig;
+      visual_from_fbconfig_fn visual_from_fbconfig;
+      create_window_fn        create_window;
+      destroy_window_fn       destroy_window;
+
+      static glx_library* get()
+      {
+         static glx_library library;
+
+         return library.m_handle ? &library : 0;
+      }
+
+   private:
+
+      glx_library()
+      {
+         m_handle = dlopen ( "libGL.so.1", RTLD_LAZY | RTLD_LOCAL );
+
+         if ( ! m_handle ) return;
+
+         choose_fbconfig = (choose_fbconfig_fn)
+                           dlsym ( m_handle, "glXChooseFBConfig" );
+         visual_from_fbconfig = (visual_from_fbconfig_fn)
+                                dlsym ( m_handle, "glXGetVisualFromFBConfig" );
+         create_window = (create_window_fn)
+                         dlsym ( m_handle, "glXCreateWindow" );
+         destroy_window = (destroy_window_fn)
+                          dlsym ( m_handle, "glXDestroyWindow" );
+
+         if ( ! choose_fbconfig || ! visual_from_fbconfig ||
+              ! create_window || ! destroy_window )
+         {
+            dlclose ( m_handle );
+            m_handle = 0;
+         }
+      }
+
+      void* m_handle;
+   };
+
    class glxwindow : public window_base
    {
    public:
 
-      /*  To create a window */
-      glxwindow ( event_dispatcher& e, rectangle r = rectangle(point(0,0),300,200) )
+      /*  To create a window. Unless 'use_gl' is set it is a plain X window
+       *  with an ARGB visual when the server has one, and libGL is never
+       *  loaded; with it, a GLX window is made if libGL can be opened. */
+      glxwindow ( event_dispatcher& e,
+                  rectangle r = rectangle(point(0,0),300,200),
+                  bool use_gl = false )
       : m_display ( e.get_display() ),
       m_event_dispatcher ( e ),
       m_is_child ( false ),
+      m_use_gl ( use_gl ),
       m_rect ( r ),
       m_parent ( 0 )
       {
          m_window = 0;
          m_atom[0] = 0;
+         glX_window = 0;
+         fbconfig = 0;
          show();
       }
 
@@ -96,11 +167,14 @@ namespace xlib
       //m_background ( e.get_display(), 197, 194, 197 ), // grey
       m_event_dispatcher ( e ),
       m_is_child ( false ),
+      m_use_gl ( false ),
       m_rect ( point(0,0), 0, 0 ),
       m_parent ( 0 ),
       m_window ( id )
       {
          m_atom[0] = 0;
+         glX_window = 0;
+         fbconfig = 0;
       }
 
       /* For a child window. 'w' is its parent. */
@@ -109,11 +183,14 @@ namespace xlib
       m_event_dispatcher ( w.get_event_dispatcher() ),
       //m_border ( m_display, 255, 255, 255 ),
       m_is_child ( true ),
+      m_use_gl ( w.m_use_gl ),
       m_rect ( w.get_rect() ),
       m_parent ( w.id() )
       {
          m_window = 0;
          m_atom[0] = 0;
+         glX_window = 0;
+         fbconfig = 0;
          show();
       }
 
@@ -131,8 +208,7 @@ namespace xlib
                         m_window,
                         event_mask );
 
-         XMapWindow ( m_display, m_window );
-         XFlush ( m_display );
+         m_display.map_window ( m_window, m_parent );
       }
 
       virtual void on_show(){}
@@ -140,7 +216,6 @@ namespace xlib
       virtual void hide()
       {
          XUnmapWindow ( m_display, m_window );
-         XFlush ( m_display );
       }
 
       virtual void on_hide()
@@ -150,73 +225,64 @@ namespace xlib
       {
          if ( ! m_window )
          {
-            /* Open GL Initialization */
-            int numfbconfigs;
-            int attr_mask;
-
             XSetWindowAttributes attr = {0,};
+            int attr_mask;
 
             Display* dply = m_display.get();
             Xscreen       = DefaultScreen( dply );
             Xroot         = RootWindow(dply, Xscreen);
 
-            fbconfigs = glXChooseFBConfig( dply, Xscreen, VisData, &numfbconfigs);
-            fbconfig  = 0;
-            for(int i = 0; i<numfbconfigs; i++) {
-
-               visual = (XVisualInfo*) glXGetVisualFromFBConfig(dply, fbconfigs[i]);
-               if(!visual)
-                  continue;
+            glX_window = 0;
+            visual     = 0;
 
-               pict_format = XRenderFindVisualFormat(dply, visual->visual);
-               if(!pict_format)
-                  continue;
-
-               fbconfig = fbconfigs[i];
-               if(pict_format->direct.alphaMask > 0) {
-                  break;
-               }
+            if ( ! ( m_use_gl && choose_gl_visual() ) )
+            {
+               choose_visual();
             }
 
-            if(fbconfig) {
         /* Create a colormap - only needed on some X clients, eg. IRIX */
-               color_map = XCreateColormap(dply, Xroot, visual->visual, AllocNone);
-
-               attr.colormap = color_map;
-               attr.background_pixmap = None;
-               attr.border_pixmap = None;
-               attr.border_pixel = 0;
-               attr.event_mask = event_mask;
-
-               attr_mask = CWBackPixmap |
-                           CWColormap |
-                           CWBorderPixel |
-                           CWEventMask;
-
-               m_window = XCreateWindow ( dply,
-                                          Xroot,
-                                          m_rect.origin().x(),
-                                          m_rect.origin().y(),
-                                          m_rect.width(),
-                                          m_rect.height(),
-                                          0,
-                                          visual->depth,
-                                          InputOutput,
-                                          visual->visual,
-                                          attr_mask, &attr);
+            color_map = XCreateColormap(dply, Xroot, visual->visual, AllocNone);
+
+            attr.colormap = color_map;
+            attr.background_pixmap = None;
+            attr.border_pixmap = None;
+            attr.border_pixel = 0;
+            attr.event_mask = event_mask;
+
+            attr_mask = CWBackPixmap |
+                        CWColormap |
+                        CWBorderPixel |
+                        CWEventMask;
+
+            m_window = XCreateWindow ( dply,
+                                       Xroot,
+                                       m_rect.origin().x(),
+                                       m_rect.origin().y(),
+                                       m_rect.width(),
+                                       m_rect.height(),
+                                       0,
+                                       visual->depth,
+                                       InputOutput,
+                                       visual->visual,
+                                       attr_mask, &attr);
 
-            }
             if ( m_window == 0 )
             {
                throw create_window_exception
                ( "could not create the window" );
             }
 
-            int glXattr[] = { None };
-            glX_window = glXCreateWindow(dply, fbconfig, m_window, glXattr);
-            if( !glX_window ) {
-               throw create_window_exception
-               ( "Could not create GLX window\n" );
+            if ( fbconfig )
+            {
+               int glXattr[] = { None };
+               glX_window = glx_library::get()->create_window ( dply,
+                                                                fbconfig,
+                                                                m_window,
+                                                                glXattr );
+               if( !glX_window ) {
+                  throw create_window_exception
+                  ( "Could not create GLX window\n" );
+               }
             }
 
             //set_background ( m_background );
@@ -241,6 +307,8 @@ namespace xlib
                                  1 );
             }
 
+            m_state.reset ( m_rect );
+
             on_create();
 
          }
@@ -257,12 +325,19 @@ namespace xlib
 
          if ( m_window )
          {
+            m_event_dispatcher.unregister_window ( this );
+            m_display.release_drawable ( m_window );
+
+            if ( glX_window )
+            {
+               glx_library::get()->destroy_window ( m_display, glX_window );
+               glX_window = 0;
+            }
+
             XDestroyWindow ( m_display, m_window );
             m_window = 0;
          }
 
-         m_event_dispatcher.unregister_window ( this );
-
          on_destroy();
       }
 
@@ -293,30 +368,18 @@ namespace xlib
          XClearWindow ( m_display,
                         m_window );
 
-         XFlush ( m_display );
-
          on_expose();
 
       }
 
+      /* answered from the shadow, see window_state.hpp */
       virtual rectangle get_rect()
       {
-         Window root;
-         int x = 0, y = 0;
-         unsigned int width = 0, height = 0, border_width = 0, depth = 0;
-         XGetGeometry ( m_display,
-                        m_window,
-                        &root,
-                        &x,
-                        &y,
-                        &width,
-                        &height,
-                        &border_width,
-                        &depth );
-
-         return rectangle ( point(x,y), width, height );
+         return m_state.geometry ( m_display, m_window );
       }
 
+      virtual window_state* get_state() { return &m_state; }
+
       virtual long id() { return m_window; }
 
       virtual void on_expose() {}
@@ -344,6 +407,7 @@ namespace xlib
       { return m_event_dispatcher; }
 
       virtual int get_depth(){ return visual->depth; }
+      bool has_gl() { return glX_window != 0; }
       virtual Colormap get_color_map(){ return color_map; }
 
       int Xscreen;
@@ -354,10 +418,88 @@ namespace xlib
       GLXWindow glX_window;
 
       rectangle m_rect;
+      window_state m_state;
 
       GLXFBConfig fbconfig;
 
-      GLXFBConfig *fbconfigs;
+   protected:
+
+      /* Plain X: a 32 bit TrueColor visual with an alpha channel, which
+       * XMatchVisualInfo finds without touching GLX, or else the default
+       * visual of the screen. */
+      void choose_visual()
+      {
+         Display* dply = m_display.get();
+
+         fbconfig = 0;
+
+         if ( XMatchVisualInfo ( dply, Xscreen, 32, TrueColor, &m_visual_info ) )
+         {
+            pict_format = XRenderFindVisualFormat ( dply, m_visual_info.visual );
+
+            if ( pict_format && pict_format->direct.alphaMask > 0 )
+            {
+               visual = &m_visual_info;
+               return;
+            }
+         }
+
+         m_visual_info.visual   = DefaultVisual ( dply, Xscreen );
+         m_visual_info.visualid = XVisualIDFromVisual ( m_visual_info.visual );
+         m_visual_info.screen   = Xscreen;
+         m_visual_info.depth    = DefaultDepth ( dply, Xscreen );
+
+         pict_format = XRenderFindVisualFormat ( dply, m_visual_info.visual );
+         visual = &m_visual_info;
+      }
+
+      /* The GLX path, preferring an fbconfig whose visual has alpha.
+       * Returns false, and the plain path is used, if libGL can not be
+       * loaded or has no usable config. */
+      bool choose_gl_visual()
+      {
+         Display* dply = m_display.get();
+         glx_library* glx = glx_library::get();
+         int numfbconfigs = 0;
+
+         fbconfig = 0;
+
+         if ( ! glx ) return false;
+
+         GLXFBConfig* fbconfigs = glx->choose_fbconfig ( dply, Xscreen,
+                                                         VisData,
+                                                         &numfbconfigs );
+         for(int i = 0; i<numfbconfigs; i++) {
+
+            XVisualInfo* vi = glx->visual_from_fbconfig ( dply, fbconfigs[i] );
+            if(!vi)
+               continue;
+
+            pict_format = XRenderFindVisualFormat(dply, vi->visual);
+            if(!pict_format) {
+               XFree ( vi );
+               continue;
+            }
+
+            fbconfig = fbconfigs[i];
+            m_visual_info = *vi;
+            XFree ( vi );
+
+            if(pict_format->direct.alphaMask > 0) {
+               break;
+            }
+         }
+
+         if ( fbconfigs )
+         {
+            XFree ( fbconfigs );
+         }
+
+         if ( ! fbconfig ) return false;
+
+         visual = &m_visual_info;
+         return true;
+      }
 
    private:
 
@@ -379,8 +521,10 @@ namespace xlib
       Atom m_atom[1];
 
       XRenderPictFormat *pict_format;
+      XVisualInfo m_visual_info;
 
       bool m_is_child;
+      bool m_use_gl;
 
    };
 
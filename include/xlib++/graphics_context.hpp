@@ -25,11 +25,13 @@
 #ifndef _xlib_graphics_context_class_
 #define _xlib_graphics_context_class_
 
+#include <X11/Xutil.h>
 #include "display.hpp"
 #include "window.hpp"
 #include "exceptions.hpp"
 #include "color.hpp"
 #include "shapes.hpp"
+#include "font_metrics.hpp"
 #include <vector>
 
 namespace xlib
@@ -43,6 +45,13 @@ namespace xlib
          XGCValues values;
          values.background = 1;
          m_gc = 0;
+         m_metrics = 0;
+         m_clip = 0;
+         font = 0;
+#ifdef HAVE_XFT
+         m_xft_font = 0;
+         std::memset ( &m_foreground, 0, sizeof(m_foreground) );
+#endif
          m_gc = XCreateGC ( m_display, m_window_id, GCBackground, &values );
 
          if ( m_gc == 0 )
@@ -52,7 +61,10 @@ namespace xlib
          }
       };
 
-      ~graphics_context(){};
+      ~graphics_context()
+      {
+         XFreeGC ( m_display, m_gc );
+      };
 
       /* drawing primitives */
 
@@ -80,6 +92,19 @@ namespace xlib
 
       void draw_text ( point origin, std::string text )
       {
+#ifdef HAVE_XFT
+         if ( m_xft_font )
+         {
+            m_display.get_text_renderer().draw_string ( m_window_id,
+                                                        m_xft_font,
+                                                        m_foreground,
+                                                        origin.x(),
+                                                        origin.y(),
+                                                        text,
+                                                        m_clip );
+            return;
+         }
+#endif
          XDrawString ( m_display,
                        m_window_id,
                        m_gc,
@@ -100,6 +125,35 @@ namespace xlib
                           rect.height() );
       }
 
+      /* Restricts drawing to 'r', pass 0 to remove the restriction */
+      void set_clip ( Region r )
+      {
+         m_clip = r;
+
+         if ( r )
+         {
+            XSetRegion ( m_display, m_gc, r );
+         }
+         else
+         {
+            XSetClipMask ( m_display, m_gc, None );
+         }
+      }
+
+      void copy_area ( Drawable dest, rectangle rect )
+      {
+         XCopyArea ( m_display,
+                     m_window_id,
+                     dest,
+                     m_gc,
+                     rect.origin().x(),
+                     rect.origin().y(),
+                     rect.width(),
+                     rect.height(),
+                     rect.origin().x(),
+                     rect.origin().y() );
+      }
+
       void fill_style ( int style = FillSolid )
       {
          XSetFillStyle( m_display, m_gc, style);
@@ -108,6 +162,9 @@ namespace xlib
 
       void set_foreground ( color *c )
       {
+#ifdef HAVE_XFT
+         m_foreground = c->m_color;
+#endif
          XSetForeground ( m_display,
                           m_gc,
                           c->pixel() );
@@ -126,17 +183,18 @@ namespace xlib
       }
       rectangle get_text_rect ( std::string text )
       {
-         int direction = 0, font_ascent = 0, font_descent = 0;
          XCharStruct char_struct;
 
-         XQueryTextExtents ( m_display,
-                             XGContextFromGC(m_gc),
-                             text.c_str(),
-                             text.size(),
-                             &direction, 
-                             &font_ascent,
-                             &font_descent,
-                             &char_struct );
+#ifdef HAVE_XFT
+         if ( m_xft_font )
+         {
+            m_display.get_text_renderer().text_extents ( m_xft_font,
+                                                         text,
+                                                         &char_struct );
+         }
+         else
+#endif
+         metrics()->text_extents ( text, &char_struct );
 
          rectangle rect ( point(0,0),
                           char_struct.rbearing - char_struct.lbearing,
@@ -148,52 +206,69 @@ namespace xlib
 
       std::vector<int> get_character_widths ( std::string text )
       {
-
-         std::vector<int> char_widths;
-
-         XFontStruct * font = XQueryFont ( m_display, (GContext)id() );
-
-         for ( std::string::const_iterator it = text.begin();
-              it != text.end(); it++ )
-              {
-                 char temp;  /*WEH: Change from std::string text temp */
-                 temp = *it; /* This line was temp += it, which is no bueno */
-
-                 int width = XTextWidth ( font, &temp, 1 );
-
-                 char_widths.push_back ( width );
-              }
-
-              return char_widths;
+#ifdef HAVE_XFT
+         if ( m_xft_font )
+         {
+            std::vector<int> char_widths;
+            text_renderer& r = m_display.get_text_renderer();
+
+            for ( std::string::size_type i = 0; i < text.size(); i++ )
+            {
+               char_widths.push_back ( r.text_width ( m_xft_font,
+                                                      text.substr ( i, 1 ) ) );
+            }
+            return char_widths;
+         }
+#endif
+         return metrics()->char_widths ( text );
       }
 
       int get_text_width ( std::string text ) {
-         int sum_of_elems = 0;
-         std::vector<int> char_widths;
-         char_widths = get_character_widths(text);
-         for(std::vector<int>::iterator j=char_widths.begin();j!=char_widths.end();++j)
-           sum_of_elems += *j;
-         return sum_of_elems;
+#ifdef HAVE_XFT
+         if ( m_xft_font )
+         {
+            return m_display.get_text_renderer().text_width ( m_xft_font, text );
+         }
+#endif
+         return metrics()->text_width ( text );
       }
 
       int get_text_height ()
       {
-         font = XQueryFont ( m_display, (GContext)id() );
+#ifdef HAVE_XFT
+         if ( m_xft_font )
+         {
+            return m_xft_font->ascent + m_xft_font->descent;
+         }
+#endif
+         return metrics()->height();
+      }
+
+      /* Fonts are cached by the display, see display::get_font. When
+       * built with Xft the name is first tried with fontconfig, and the
+       * core font is only loaded if that fails. */
+      int set_font ( const char* name )
+      {
+#ifdef HAVE_XFT
+         m_xft_font = m_display.get_text_renderer().get_font ( name );
 
-         if ( font )
+         if ( m_xft_font )
          {
-            return font->max_bounds.ascent + font->max_bounds.descent;
+            return 1;
          }
-         else
+#endif
+         font_metrics* fm = m_display.get_font ( name );
+
+         if ( ! fm )
          {
             return 0;
          }
-      }
 
-      int set_font ( const char* name )
-      {
-         font = XLoadQueryFont( m_display, name );
-         XSetFont(m_display, m_gc, font->fid);
+         m_metrics = fm;
+         font = fm->get();
+         XSetFont(m_display, m_gc, fm->fid());
+
+         return 1;
       }
 
       long id() { return XGContextFromGC(m_gc); }
@@ -201,6 +276,23 @@ namespace xlib
       XFontStruct *font;
 
    private:
+
+      font_metrics* metrics()
+      {
+         if ( ! m_metrics )
+         {
+            m_metrics = m_display.get_default_font ( m_gc );
+            font = m_metrics->get();
+         }
+         return m_metrics;
+      }
+
+      font_metrics* m_metrics;
+      Region m_clip;
+#ifdef HAVE_XFT
+      XftFont* m_xft_font;
+      XColor m_foreground;
+#endif
       GC m_gc;
       display& m_display;
       int m_window_id;
@@ -37,6 +37,7 @@
 #include "shapes.hpp"
 #include "label_base.hpp"
 #include "window_base.hpp"
+#include "window_state.hpp"
 #include "graphics_context.hpp"
 #include "pointer.hpp"
 
@@ -73,10 +74,10 @@ namespace xlib
          XSelectInput ( m_display,
                         m_window,
                         ExposureMask |
+                        StructureNotifyMask |
                         SubstructureNotifyMask );
 
-         XMapWindow ( m_display, m_window );
-         XFlush ( m_display );
+         m_display.map_window ( m_window, m_parent.id() );
       }
 
       virtual void on_show(){ on_expose(); }
@@ -84,7 +85,6 @@ namespace xlib
       virtual void hide()
       {
          XUnmapWindow ( m_display, m_window );
-         XFlush ( m_display );
       }
 
       virtual void on_hide(){}
@@ -109,6 +109,8 @@ namespace xlib
             ( "could not create label" );
          }
 
+         m_state.reset ( m_rect );
+
          m_parent.get_event_dispatcher().register_window ( (window_base*) this );
          //set_background ( m_background );
          on_expose();
@@ -118,11 +120,11 @@ namespace xlib
       {
          if ( m_window )
          {
+            m_parent.get_event_dispatcher().unregister_window ( (window_base*) this );
+            m_display.release_drawable ( m_window );
             XDestroyWindow ( m_display, m_window );
             m_window = 0;
          }
-
-         m_parent.get_event_dispatcher().unregister_window ( (window_base*) this );
       }
 
       virtual void set_background ( color& c )
@@ -132,28 +134,16 @@ namespace xlib
          XSetWindowBackground ( m_display, m_window, c.pixel() );
 
          XClearWindow ( m_display, m_window );
-
-         XFlush ( m_display );
       }
 
+      /* answered from the shadow, see window_state.hpp */
       virtual rectangle get_rect()
       {
-         Window root;
-         int x = 0, y = 0;
-         unsigned int width = 0, height = 0, border_width = 0, depth = 0;
-         XGetGeometry ( m_display,
-                        m_window,
-                        &root,
-                        &x,
-                        &y,
-                        &width,
-                        &height,
-                        &border_width,
-                        &depth );
-
-         return rectangle ( point(0,0), width, height );
+         return m_state.area ( m_display, m_window );
       }
 
+      virtual window_state* get_state() { return &m_state; }
+
       virtual void set_focus() {}
 
       virtual void refresh ()
@@ -162,8 +152,6 @@ namespace xlib
          XClearWindow ( m_display,
                         m_window );
 
-         XFlush ( m_display );
-
          on_expose();
       }
 
@@ -174,6 +162,8 @@ namespace xlib
 
       virtual void on_expose()
       {
+         display::scope cost ( m_display, "label::paint" );
+
          /* draw the label */
          rectangle rect = get_rect();
 
@@ -275,6 +265,7 @@ namespace xlib
 
       color *m_background;
       rectangle m_rect;
+      window_state m_state;
 
    };
 
@@ -0,0 +1,288 @@
+/* text_renderer.hpp
+   definition of the xlib::text_renderer class
+*/
+/**
+ * @par xlib++ - X Low level Widget Routines
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This file was added to Rob Tougher's <robt@robtougher.com> collection
+ * of c++ classes for creating widgets using low level X routines, i.e.
+ * no dependencies on the G or K lib's.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+
+#ifndef _xlib_text_renderer_class_
+#define _xlib_text_renderer_class_
+
+#ifdef HAVE_XFT
+
+#include <map>
+#include <string>
+#include <cstring>
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+
+namespace xlib
+{
+   /*!
+    * \class text_renderer
+    *
+    * \brief Anti-aliased text drawing through XRender.
+    *
+    * Fonts are opened with fontconfig, so they do not depend on the font
+    * path of the X server. Xft rasterizes each glyph with FreeType the
+    * first time it is used and uploads it into an XRender GlyphSet; after
+    * that a string is drawn with a single XRenderCompositeString request
+    * carrying a few bytes per glyph. Metrics come from the same client
+    * side glyph cache, no round trip is needed to measure text.
+    *
+    * One instance is owned by xlib::display, see display::get_text_renderer.
+    */
+   class text_renderer
+   {
+   public:
+
+      text_renderer ( Display* d ) : m_display ( d ) {}
+
+      ~text_renderer()
+      {
+         std::map<Drawable, XftDraw*>::iterator di;
+         std::map<color_key, XftColor>::iterator ci;
+         std::map<std::string, XftFont*>::iterator fi;
+
+         for ( ci = m_colors.begin(); ci != m_colors.end(); ci++ )
+         {
+            XftColorFree ( m_display,
+                           ci->first.visual,
+                           ci->first.colormap,
+                           &ci->second );
+         }
+
+         for ( di = m_draws.begin(); di != m_draws.end(); di++ )
+         {
+            XftDrawDestroy ( di->second );
+         }
+
+         for ( fi = m_fonts.begin(); fi != m_fonts.end(); fi++ )
+         {
+            if ( fi->second )
+            {
+               XftFontClose ( m_display, fi->second );
+            }
+         }
+      }
+
+      /* Accepts the same XLFD names as XLoadQueryFont. Returns 0 if
+       * fontconfig has nothing that matches, the caller should then fall
+       * back to the core font. */
+      XftFont* get_font ( const std::string& name )
+      {
+         std::map<std::string, XftFont*>::iterator it = m_fonts.find ( name );
+
+         if ( it != m_fonts.end() )
+         {
+            return it->second;
+         }
+
+         XftFont* font = XftFontOpenXlfd ( m_display,
+                                           DefaultScreen ( m_display ),
+                                           name.c_str() );
+
+         m_fonts[name] = font;
+
+         return font;
+      }
+
+      void draw_string ( Drawable d, XftFont* font, XColor& c,
+                         int x, int y, const std::string& text,
+                         Region clip = 0 )
+      {
+         XftDraw* draw = get_draw ( d );
+
+         if ( ! draw ) return;
+
+         XftDrawSetClip ( draw, clip );
+
+         XftColor* xft_color = get_color ( draw, c );
+
+         if ( ! xft_color ) return;
+
+         XftDrawString8 ( draw,
+                          xft_color,
+                          font,
+                          x,
+                          y,
+                          (const FcChar8*) text.c_str(),
+                          text.size() );
+      }
+
+      /* Fills 'overall' the way XTextExtents would for a core font */
+      void text_extents ( XftFont* font, const std::string& text,
+                          XCharStruct* overall )
+      {
+         XGlyphInfo info;
+
+         XftTextExtents8 ( m_display,
+                           font,
+                           (const FcChar8*) text.c_str(),
+                           text.size(),
+                           &info );
+
+         overall->lbearing = -info.x;
+         overall->rbearing = info.width - info.x;
+         overall->ascent   = info.y;
+         overall->descent  = info.height - info.y;
+         overall->width    = info.xOff;
+         overall->attributes = 0;
+      }
+
+      int text_width ( XftFont* font, const std::string& text )
+      {
+         XCharStruct overall;
+         text_extents ( font, text, &overall );
+         return overall.width;
+      }
+
+      /* Pixmaps can not be asked for their visual, so they are registered
+       * with the visual and colormap of the window they are shown in */
+      void bind ( Drawable d, Visual* visual, Colormap colormap )
+      {
+         release ( d );
+
+         XftDraw* draw = XftDrawCreate ( m_display, d, visual, colormap );
+
+         if ( draw )
+         {
+            m_draws[d] = draw;
+         }
+      }
+
+      /* Called when a drawable is destroyed so its XftDraw does not leak */
+      void release ( Drawable d )
+      {
+         std::map<Drawable, XftDraw*>::iterator it = m_draws.find ( d );
+
+         if ( it != m_draws.end() )
+         {
+            XftDrawDestroy ( it->second );
+            m_draws.erase ( it );
+         }
+      }
+
+   private:
+
+      struct color_key
+      {
+         Visual* visual;
+         Colormap colormap;
+         unsigned short red, green, blue;
+
+         bool operator < ( const color_key& k ) const
+         {
+            if ( visual != k.visual ) return visual < k.visual;
+            if ( colormap != k.colormap ) return colormap < k.colormap;
+            if ( red != k.red ) return red < k.red;
+            if ( green != k.green ) return green < k.green;
+            return blue < k.blue;
+         }
+      };
+
+      /* The visual and colormap of a window are asked for once; child
+       * widgets inherit the ARGB visual of the login window, so the
+       * default visual can not be assumed. */
+      XftDraw* get_draw ( Drawable d )
+      {
+         std::map<Drawable, XftDraw*>::iterator it = m_draws.find ( d );
+
+         if ( it != m_draws.end() )
+         {
+            return it->second;
+         }
+
+         XWindowAttributes attr;
+
+         if ( ! XGetWindowAttributes ( m_display, d, &attr ) )
+         {
+            return 0;
+         }
+
+         XftDraw* draw = XftDrawCreate ( m_display,
+                                         d,
+                                         attr.visual,
+                                         attr.colormap );
+         if ( draw )
+         {
+            m_draws[d] = draw;
+         }
+
+         return draw;
+      }
+
+      XftColor* get_color ( XftDraw* draw, XColor& c )
+      {
+         color_key key;
+
+         key.visual   = XftDrawVisual ( draw );
+         key.colormap = XftDrawColormap ( draw );
+         key.red      = c.red;
+         key.green    = c.green;
+         key.blue     = c.blue;
+
+         std::map<color_key, XftColor>::iterator it = m_colors.find ( key );
+
+         if ( it != m_colors.end() )
+         {
+            return &it->second;
+         }
+
+         XRenderColor render_color;
+         XftColor xft_color;
+
+         render_color.red   = c.red;
+         render_color.green = c.green;
+         render_color.blue  = c.blue;
+         render_color.alpha = 0xffff;
+
+         if ( ! XftColorAllocValue ( m_display,
+                                     key.visual,
+                                     key.colormap,
+                                     &render_color,
+                                     &xft_color ) )
+         {
+            return 0;
+         }
+
+         return &( m_colors[key] = xft_color );
+      }
+
+      /* Not copyable */
+      text_renderer ( const text_renderer& );
+      void operator = ( text_renderer& );
+
+      Display* m_display;
+
+      std::map<std::string, XftFont*> m_fonts;
+      std::map<Drawable, XftDraw*> m_draws;
+      std::map<color_key, XftColor> m_colors;
+   };
+
+};
+
+#endif /* HAVE_XFT */
+
+#endif
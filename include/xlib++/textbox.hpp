@@ -36,7 +36,9 @@
 #include "color.hpp"
 #include "shapes.hpp"
 #include "window_base.hpp"
+#include "window_state.hpp"
 #include "graphics_context.hpp"
+#include "damage.hpp"
 #include "pointer.hpp"
 
 enum Text_Alignment {
@@ -64,7 +66,8 @@ namespace xlib
       m_is_down ( false ),
       m_is_mouse_over ( false ),
       m_has_focus ( false ),
-      m_rect ( rect )
+      m_rect ( rect ),
+      m_buffer ( parent.get_display() )
       {
          password_char[0] = '*';
          password_char[1]= '\0';
@@ -101,10 +104,10 @@ namespace xlib
                         FocusChangeMask |
                         KeyPressMask |
                         KeyReleaseMask |
+                        StructureNotifyMask |
                         SubstructureNotifyMask );
 
-         XMapWindow ( m_display, m_window );
-         XFlush ( m_display );
+         m_display.map_window ( m_window, m_parent.id() );
       }
 
       virtual void on_show(){}
@@ -112,7 +115,6 @@ namespace xlib
       virtual void hide()
       {
          XUnmapWindow ( m_display, m_window );
-         XFlush ( m_display );
       }
 
       virtual void on_hide(){}
@@ -137,6 +139,11 @@ namespace xlib
             ( "could not create the command text_box" );
          }
 
+         /* painted from the back buffer, see button::create */
+         XSetWindowBackgroundPixmap ( m_display, m_window, None );
+
+         m_state.reset ( m_rect );
+
          m_parent.get_event_dispatcher().register_window ( (window_base*) this );
          set_background ( m_background );
 
@@ -146,57 +153,36 @@ namespace xlib
       {
          if ( m_window )
          {
+            m_parent.get_event_dispatcher().unregister_window ( (window_base*) this );
+            m_display.release_drawable ( m_window );
             XDestroyWindow ( m_display, m_window );
             m_window = 0;
          }
-
-         m_parent.get_event_dispatcher().unregister_window ( (window_base*) this );
       }
 
       virtual void set_background ( color& c )
       {
          m_background.set ( c );
-
-         XSetWindowBackground ( m_display, m_window, c.pixel() );
-
-         XClearWindow ( m_display, m_window );
-
-         XFlush ( m_display );
+         refresh();
       }
 
       virtual void SetBackgroundColor ( short red, short green, short blue )
       {
          m_background.set_color ( red, green, blue );
-
-         XSetWindowBackground ( m_display, m_window, m_background.pixel() );
-
-         XClearWindow ( m_display, m_window );
-
-         XFlush ( m_display );
+         refresh();
       }
 
+      /* answered from the shadow, see window_state.hpp */
       virtual rectangle get_rect()
       {
-         Window root;
-         int x = 0, y = 0;
-         unsigned int width = 0, height = 0, border_width = 0, depth = 0;
-         XGetGeometry ( m_display,
-                        m_window,
-                        &root,
-                        &x,
-                        &y,
-                        &width,
-                        &height,
-                        &border_width,
-                        &depth );
-
-         return rectangle ( point(0,0), width, height );
+         return m_state.area ( m_display, m_window );
       }
 
-      void draw_cursor() {
+      virtual window_state* get_state() { return &m_state; }
+
+      void draw_cursor ( graphics_context& gc ) {
 
          color black ( m_display, 200, 0, 0 );
-         graphics_context gc ( m_display, id() );
          int x, y, y1, y2;
 
          gc.set_foreground ( &black );
@@ -229,11 +215,43 @@ namespace xlib
          refresh();
       }
 
+      /* Marks the whole box dirty, it is painted once per loop turn, so a
+       * burst of key strokes costs a single repaint */
       virtual void refresh ()
       {
-         XClearWindow ( m_display, m_window );
-         XFlush ( m_display );
-         on_expose();
+         invalidate ( rectangle ( point(0,0), m_rect.width(), m_rect.height() ) );
+         get_event_dispatcher().schedule_paint ( this );
+      }
+
+      virtual bool invalidate ( rectangle r )
+      {
+         m_damage.add ( r );
+         return true;
+      }
+
+      virtual void paint()
+      {
+         if ( m_damage.empty() || ! m_window ) return;
+
+         display::scope cost ( m_display, "text_box::paint" );
+
+         Pixmap pm = m_buffer.get ( m_window, m_rect.width(), m_rect.height() );
+
+         if ( ! pm ) return;
+
+         graphics_context gc ( m_display, pm );
+         rectangle area = m_damage.bounds();
+
+         gc.set_clip ( m_damage.region() );
+
+         gc.set_foreground ( &m_background );
+         gc.fill_rectangle ( area );
+
+         draw ( gc );
+
+         gc.copy_area ( m_window, area );
+
+         m_damage.clear();
       }
 
       /* window_base */
@@ -243,12 +261,15 @@ namespace xlib
 
       virtual void on_expose()
       {
+         invalidate ( rectangle ( point(0,0), m_rect.width(), m_rect.height() ) );
+         paint();
+      }
 
+      virtual void draw ( graphics_context& gc )
+      {
          /* draw the text_box */
          rectangle rect = get_rect();
 
-         graphics_context gc ( m_display, id() );
-
          color black ( m_display, 0, 0, 0 );
          color white ( m_display, 255, 255, 255 );
          color gray ( m_display, 131, 129, 131 );
@@ -323,7 +344,7 @@ namespace xlib
          gc.draw_line ( line ( point ( rect.width()-2, 1 ),
                                point(rect.width()-2,rect.height()-2) ) );
          if ( m_has_focus ) {
-           draw_cursor();
+           draw_cursor ( gc );
          }
       }
 
@@ -467,10 +488,14 @@ namespace xlib
       bool m_is_down, m_is_mouse_over, m_has_focus;
       color m_background;
       rectangle m_rect;
+      window_state m_state;
       int position;
       int capslock;
 
       char password_char[2];
+
+      damage m_damage;
+      back_buffer m_buffer;
    };
 
 };
@@ -0,0 +1,237 @@
+/* timer_wheel.hpp
+   definition of the xlib::timer_wheel class
+*/
+/**
+ * @par xlib++ - X Low level Widget Routines
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This file was added to Rob Tougher's <robt@robtougher.com> collection
+ * of c++ classes for creating widgets using low level X routines, i.e.
+ * no dependencies on the G or K lib's.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+
+#ifndef _xlib_timer_wheel_class_
+#define _xlib_timer_wheel_class_
+
+#include <map>
+#include <list>
+#include <vector>
+#include <time.h>
+
+namespace xlib
+{
+   /*! \brief Implemented by anything that wants timer callbacks */
+   class timer_handler
+   {
+   public:
+      virtual ~timer_handler() {}
+      virtual void on_timer ( int id ) = 0;
+   };
+
+   /*!
+    * \class timer_wheel
+    *
+    * \brief Hashed timing wheel used by event_dispatcher.
+    *
+    * Time is cut into ticks of tick_ms milliseconds and a timer goes into
+    * the slot of the tick it expires on, with the number of whole turns
+    * of the wheel still to wait. Adding and cancelling are O(1) apart
+    * from the id lookup, and advancing only visits the slots that passed.
+    */
+   class timer_wheel
+   {
+   public:
+
+      enum { tick_ms = 10, slots = 256 };
+
+      timer_wheel() : m_slots ( slots ), m_current ( 0 ), m_next_id ( 1 )
+      {
+         m_last = now();
+      }
+
+      ~timer_wheel()
+      {
+         std::map<int, timer*>::iterator it;
+
+         for ( it = m_timers.begin(); it != m_timers.end(); it++ )
+         {
+            delete it->second;
+         }
+      }
+
+      /* Calls h->on_timer after 'ms' milliseconds, and then every 'ms'
+       * milliseconds if 'repeat' is set. Returns the id for cancel(). */
+      int add ( unsigned int ms, timer_handler* h, bool repeat = false )
+      {
+         timer* t = new timer;
+
+         t->id       = m_next_id++;
+         t->ticks    = ( ms + tick_ms - 1 ) / tick_ms;
+         t->handler  = h;
+         t->repeat   = repeat;
+
+         if ( t->ticks == 0 ) t->ticks = 1;
+
+         m_timers[t->id] = t;
+         schedule ( t );
+
+         return t->id;
+      }
+
+      void cancel ( int id )
+      {
+         std::map<int, timer*>::iterator it = m_timers.find ( id );
+
+         if ( it == m_timers.end() ) return;
+
+         timer* t = it->second;
+
+         m_slots[t->slot].erase ( t->position );
+         m_timers.erase ( it );
+         delete t;
+      }
+
+      bool empty() { return m_timers.empty(); }
+
+      /* Milliseconds poll() may sleep before the next timer is due, -1
+       * when there are no timers. At most one turn of the wheel. */
+      int timeout()
+      {
+         if ( m_timers.empty() ) return -1;
+
+         for ( int i = 1; i <= slots; i++ )
+         {
+            std::list<timer*>& slot = m_slots[( m_current + i ) % slots];
+
+            for ( std::list<timer*>::iterator it = slot.begin();
+                  it != slot.end(); it++ )
+            {
+               if ( ( *it )->rounds == 0 )
+               {
+                  long ms = i * tick_ms - ( now() - m_last );
+                  return ms > 0 ? ms : 0;
+               }
+            }
+         }
+
+         return slots * tick_ms;
+      }
+
+      /* Fires every timer whose tick has passed */
+      void advance()
+      {
+         long elapsed = ( now() - m_last ) / tick_ms;
+
+         for ( ; elapsed > 0; elapsed-- )
+         {
+            m_last += tick_ms;
+            m_current = ( m_current + 1 ) % slots;
+            expire ( m_slots[m_current] );
+         }
+      }
+
+   private:
+
+      struct timer
+      {
+         int id;
+         unsigned int ticks;
+         unsigned int rounds;
+         int slot;
+         std::list<timer*>::iterator position;
+         timer_handler* handler;
+         bool repeat;
+      };
+
+      void schedule ( timer* t )
+      {
+         t->slot   = ( m_current + t->ticks ) % slots;
+         t->rounds = ( t->ticks - 1 ) / slots;
+
+         m_slots[t->slot].push_back ( t );
+         t->position = --m_slots[t->slot].end();
+      }
+
+      /* Handlers may add or cancel timers, so the due ids are collected
+       * first and looked up again before each call. */
+      void expire ( std::list<timer*>& slot )
+      {
+         std::vector<int> due;
+         std::list<timer*>::iterator it;
+
+         for ( it = slot.begin(); it != slot.end(); it++ )
+         {
+            if ( ( *it )->rounds == 0 )
+            {
+               due.push_back ( ( *it )->id );
+            }
+            else
+            {
+               ( *it )->rounds--;
+            }
+         }
+
+         for ( std::vector<int>::size_type i = 0; i < due.size(); i++ )
+         {
+            std::map<int, timer*>::iterator ti = m_timers.find ( due[i] );
+
+            if ( ti == m_timers.end() ) continue;
+
+            timer* t = ti->second;
+            timer_handler* h = t->handler;
+
+            slot.erase ( t->position );
+
+            if ( t->repeat )
+            {
+               schedule ( t );
+            }
+            else
+            {
+               m_timers.erase ( ti );
+               delete t;
+            }
+
+            h->on_timer ( due[i] );
+         }
+      }
+
+      static long now()
+      {
+         struct timespec ts;
+
+         clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+         return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+      }
+
+      /* Not copyable */
+      timer_wheel ( const timer_wheel& );
+      void operator = ( timer_wheel& );
+
+      std::vector< std::list<timer*> > m_slots;
+      std::map<int, timer*> m_timers;
+      int m_current;
+      long m_last;
+      int m_next_id;
+   };
+
+};
+
+#endif
@@ -30,6 +30,7 @@
 #include <X11/Xlib.h>
 #include <sstream>
 #include "window_base.hpp"
+#include "window_state.hpp"
 #include "event_dispatcher.hpp"
 #include "color.hpp"
 #include "shapes.hpp"
@@ -114,8 +115,7 @@ namespace xlib
                         m_window,
                         event_mask );
 
-         XMapWindow ( m_display, m_window );
-         XFlush ( m_display );
+         m_display.map_window ( m_window, m_parent );
       }
 
       virtual void on_show(){}
@@ -123,7 +123,6 @@ namespace xlib
       virtual void hide()
       {
          XUnmapWindow ( m_display, m_window );
-         XFlush ( m_display );
       }
 
       virtual void on_hide()
@@ -172,6 +171,8 @@ namespace xlib
                ( "could not create the window" );
             }
 
+            m_state.reset ( m_rect );
+
             on_create();
 
          }
@@ -188,12 +189,12 @@ namespace xlib
 
          if ( m_window )
          {
+            m_event_dispatcher.unregister_window ( this );
+            m_display.release_drawable ( m_window );
             XDestroyWindow ( m_display, m_window );
             m_window = 0;
          }
 
-         m_event_dispatcher.unregister_window ( this );
-
          on_destroy();
       }
 
@@ -224,30 +225,18 @@ namespace xlib
          XClearWindow ( m_display,
                         m_window );
 
-         XFlush ( m_display );
-
          on_expose();
 
       }
 
+      /* answered from the shadow, see window_state.hpp */
       virtual rectangle get_rect()
       {
-         Window root;
-         int x = 0, y = 0;
-         unsigned int width = 0, height = 0, border_width = 0, depth = 0;
-         XGetGeometry ( m_display,
-                        m_window,
-                        &root,
-                        &x,
-                        &y,
-                        &width,
-                        &height,
-                        &border_width,
-                        &depth );
-
-         return rectangle ( point(x,y), width, height );
+         return m_state.geometry ( m_display, m_window );
       }
 
+      virtual window_state* get_state() { return &m_state; }
+
       virtual long id() { return m_window; }
 
       virtual void on_expose() {}
@@ -276,6 +265,7 @@ namespace xlib
       { return m_event_dispatcher; }
 
       rectangle m_rect;
+      window_state m_state;
 
    private:color 
 
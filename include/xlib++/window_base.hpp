@@ -35,6 +35,7 @@ namespace xlib
 
   class event_dispatcher;
   class display;
+  class window_state;
 
   class window_base
     {
@@ -56,6 +57,18 @@ namespace xlib
       virtual event_dispatcher& get_event_dispatcher() = 0;
       virtual display& get_display() = 0;
 
+      /* Retained rendering, see damage.hpp. A widget that keeps its own
+       * back buffer adds 'r' to its damage and returns true; the event
+       * dispatcher then calls paint() once before it blocks again. The
+       * default asks for plain on_expose() calls instead. */
+      virtual bool invalidate ( rectangle r ) { return false; }
+      virtual void paint() {}
+
+      /* Client side copy of geometry, map state and focus that the event
+       * dispatcher keeps current, see window_state.hpp. 0 if the widget
+       * does not keep one. */
+      virtual window_state* get_state() { return 0; }
+
       // callbacks
       virtual void on_expose() = 0;
 
@@ -0,0 +1,167 @@
+/* window_state.hpp
+   definition of the xlib::window_state class
+*/
+/**
+ * @par xlib++ - X Low level Widget Routines
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This file was added to Rob Tougher's <robt@robtougher.com> collection
+ * of c++ classes for creating widgets using low level X routines, i.e.
+ * no dependencies on the G or K lib's.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+
+#ifndef _xlib_window_state_class_
+#define _xlib_window_state_class_
+
+#include <X11/Xlib.h>
+#ifdef XLIBXX_CHECK_SHADOW
+#include <cassert>
+#endif
+#include "shapes.hpp"
+
+namespace xlib
+{
+   /*!
+    * \class window_state
+    *
+    * \brief Client side shadow of the geometry, map state and focus of
+    *        a widget's window.
+    *
+    * A widget knows its geometry when it creates its window, and after
+    * that the server reports every change with ConfigureNotify, MapNotify,
+    * UnmapNotify, FocusIn and FocusOut; event_dispatcher feeds those in.
+    * get_rect is answered from here without an XGetGeometry round trip.
+    * A window the widget did not create is queried once, the first time.
+    *
+    * Compile with -DXLIBXX_CHECK_SHADOW to have every query compared with
+    * the server, it asserts if the shadow has gone wrong.
+    */
+   class window_state
+   {
+   public:
+
+      window_state()
+      : m_rect ( point(0,0), 0, 0 ), m_known ( false ),
+        m_mapped ( false ), m_focused ( false ) {}
+
+      /* The window was just created with geometry 'r' */
+      void reset ( rectangle r )
+      {
+         m_rect    = r;
+         m_known   = true;
+         m_mapped  = false;
+         m_focused = false;
+      }
+
+      /* Position relative to the parent, and size */
+      rectangle geometry ( Display* d, Window w )
+      {
+         if ( ! m_known )
+         {
+            query ( d, w );
+         }
+#ifdef XLIBXX_CHECK_SHADOW
+         check ( d, w );
+#endif
+         return m_rect;
+      }
+
+      /* Same size, in the window's own coordinates */
+      rectangle area ( Display* d, Window w )
+      {
+         rectangle r = geometry ( d, w );
+
+         return rectangle ( point(0,0), r.width(), r.height() );
+      }
+
+      bool mapped()  { return m_mapped; }
+      bool focused() { return m_focused; }
+
+      /* A window manager tells a reparented top level where it is with a
+       * synthetic event in root coordinates; only the size is taken from
+       * those, the position stays relative to the parent. */
+      void configure ( const XConfigureEvent& e )
+      {
+         point origin = m_rect.origin();
+
+         if ( ! e.send_event )
+         {
+            origin = point ( e.x, e.y );
+         }
+
+         m_rect  = rectangle ( origin, e.width, e.height );
+         m_known = true;
+      }
+
+      void set_mapped ( bool mapped )   { m_mapped = mapped; }
+      void set_focused ( bool focused ) { m_focused = focused; }
+
+   private:
+
+      void query ( Display* d, Window w )
+      {
+         Window root;
+         int x = 0, y = 0;
+         unsigned int width = 0, height = 0, border_width = 0, depth = 0;
+
+         if ( ! w ) return;
+
+         XGetGeometry ( d, w, &root, &x, &y,
+                        &width, &height, &border_width, &depth );
+
+         m_rect  = rectangle ( point(x,y), width, height );
+         m_known = true;
+      }
+
+#ifdef XLIBXX_CHECK_SHADOW
+      /* Events still in the queue legitimately put the shadow behind the
+       * server, the comparison is only made once they are handled. */
+      void check ( Display* d, Window w )
+      {
+         XWindowAttributes attr;
+
+         if ( ! w ) return;
+
+         XSync ( d, False );
+
+         if ( XEventsQueued ( d, QueuedAlready ) )
+         {
+            return;
+         }
+
+         if ( ! XGetWindowAttributes ( d, w, &attr ) )
+         {
+            return;
+         }
+
+         assert ( m_rect.width() == attr.width );
+         assert ( m_rect.height() == attr.height );
+         assert ( m_mapped == ( attr.map_state != IsUnmapped ) );
+      }
+#endif
+
+      rectangle m_rect;
+      bool m_known;
+      bool m_mapped;
+      bool m_focused;
+   };
+
+};
+
+#endif
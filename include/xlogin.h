@@ -85,4 +85,12 @@ public:
   int  login();
 
 };
+
+/* The dialog is built as the loadable module xlogin.so, this is the one
+ * symbol it exports, see greeter.cc */
+#define XLOGIN_ENTRY "xlogin_run"
+
+typedef int (*xlogin_entry)(Dilithium *d);
+
+extern "C" int xlogin_run(Dilithium *d);
 #endif
\ No newline at end of file
@@ -19,33 +19,36 @@ dnl along with this program; if not, write to the Free Software
 dnl Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 dnl 02110-1301 USA
 dnl
-dnl Check for libgcrypt
+dnl Check for libgcrypt. Magic cookies come from getrandom(2) or
+dnl /dev/urandom, libgcrypt is only used, when asked for with
+dnl --with-gcrypt, if neither of those can be read.
 
 AC_DEFUN([AX_LIB_CRYPTO],[
 
-  AC_CHECK_HEADER([gcrypt.h],
-        [
-           AC_DEFINE(HAVE_GCRYPT, 1, [Gcrypt support])
-           AC_SUBST(HAVE_GCRYPT)
-           have_gcrypt="yes"
-
-        ], [
-               have_gcrypt="no"
-  ])
-
-  if test "x$have_gcrypt" != "xyes" ; then
-    GCRYPT_CFLAGS=""
-    GCRYPT_LIBS=""
-    AC_MSG_WARN([[
-***
-*** The libgcrypt is required to make the xauthxx and login objects!
-***]])
+  AC_ARG_WITH([gcrypt],
+    [AS_HELP_STRING([--with-gcrypt],
+                    [fall back to libgcrypt for magic cookie bytes])],
+    [], [with_gcrypt="no"])
+
+  have_gcrypt="no"
+  GCRYPT_CFLAGS=""
+  GCRYPT_LIBS=""
+
+  if test "x$with_gcrypt" != "xno" ; then
+
+    AC_CHECK_HEADER([gcrypt.h],
+          [
+             AC_DEFINE(HAVE_GCRYPT, 1, [Gcrypt support])
+             AC_SUBST(HAVE_GCRYPT)
+             have_gcrypt="yes"
+             GCRYPT_CFLAGS=`libgcrypt-config --cflags 2>/dev/null`
+             GCRYPT_LIBS=`libgcrypt-config --libs 2>/dev/null || echo -lgcrypt`
+          ], [
+             AC_MSG_ERROR([[--with-gcrypt was given but gcrypt.h was not found]])
+    ])
   fi
 
   AC_SUBST(GCRYPT_CFLAGS)
   AC_SUBST(GCRYPT_LIBS)
 
-##  AC_MSG_RESULT($have_gcrypt)
-
 ])
-
@@ -0,0 +1,53 @@
+# dilithium-lib_xft.m4                                  -*-Autoconf-*-
+# serial 1.0
+
+dnl Check for the X FreeType library
+dnl Copyright (C) 2013  dilithium Contributors (see ChangeLog for details)
+dnl
+dnl This program is free software; you can redistribute it and/or modify
+dnl it under the terms of the GNU General Public License as published by
+dnl the Free Software Foundation; either version 2 of the License, or
+dnl (at your option) any later version.
+dnl
+dnl This program is distributed in the hope that it will be useful,
+dnl but WITHOUT ANY WARRANTY; without even the implied warranty of
+dnl MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+dnl GNU General Public License for more details.
+dnl
+dnl You should have received a copy of the GNU General Public License
+dnl along with this program; if not, write to the Free Software
+dnl Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+dnl 02110-1301 USA
+dnl
+dnl Check for libXft, used by xlib++ to draw anti-aliased text through
+dnl XRender. Without it the login dialog falls back to core X fonts.
+
+AC_DEFUN([AX_LIB_XFT],[
+
+  AC_ARG_ENABLE([xft],
+    [AS_HELP_STRING([--disable-xft],
+                    [draw login dialog text with core X fonts])],
+    [], [enable_xft="yes"])
+
+  have_xft="no"
+  XFT_CFLAGS=""
+  XFT_LIBS=""
+
+  if test "x$enable_xft" != "xno" ; then
+
+    AC_MSG_CHECKING([for Xft])
+
+    if pkg-config --exists xft 2>/dev/null ; then
+      XFT_CFLAGS=`pkg-config --cflags xft`
+      XFT_LIBS=`pkg-config --libs xft`
+      have_xft="yes"
+      AC_DEFINE(HAVE_XFT, 1, [Xft support])
+    fi
+
+    AC_MSG_RESULT($have_xft)
+  fi
+
+  AC_SUBST(XFT_CFLAGS)
+  AC_SUBST(XFT_LIBS)
+
+])
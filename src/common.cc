@@ -30,11 +30,7 @@
 #include "dilithium.h"
 #include "daemon.h"
 #include "ascii.h"
-
-char  output_buffer[256];
-char  message_buffer[128];
-char *ptr_output_buffer  = &output_buffer[0];
-char *ptr_message_buffer = &message_buffer[0];
+#include "logger.h"
 
 bool  BeQuite        = false;
 bool  DebugMode      = false;
@@ -42,6 +38,8 @@ bool  DaemonMode     = false;
 bool  DropPrivileges = true;
 bool  KillX          = true;
 bool  UseXinit       = false;
+bool  RuntimeAuth    = false;
+bool  AdaptiveTimeout= false;
 bool  Verbose        = false;
 bool  DilithiumLog   = true;
 
@@ -50,37 +48,29 @@ bool  DilithiumLog   = true;
  *  \par Function Description
  *  This function Display error messages including 'errno' diagnostic,
  *  but does NOT terminates the process. If daemon mode is active then
- *  messages are directed to the system log.
+ *  messages are directed to the system log. The message is queued for
+ *  the logger, see logger.h, nothing here waits on output.
  */
 void ErrorMessage(const char *format, ...)
 {
   int ecode = errno;
+  int targets;
   va_list args;
-  va_start (args, format);
-  vsnprintf ( ptr_message_buffer, sizeof(message_buffer), format, args);
-  va_end (args);
-
-  strcpy(ptr_output_buffer, "Dilithium Error: ");
-  strcat(ptr_output_buffer, ptr_message_buffer);
-
-  if (ecode != 0) {
-    strcat ( ptr_output_buffer, " ");
-    strcat ( ptr_output_buffer, strerror(ecode));
-  }
 
   if (DaemonMode) {
-    openlog(DAEMON_NAME, LOG_DAEMON | LOG_NDELAY | LOG_PERROR | LOG_PID, LOG_USER);
-    syslog(LOG_NOTICE, "%s", ptr_output_buffer );
+    targets = LOG_TO_SYSLOG | LOG_TO_STDERR;
   }
   else {
-    std::cerr << ptr_output_buffer << std::endl;
+    targets = LOG_TO_STDERR;
   }
 
   if ( DilithiumLog ) {
-    Write2Log(ptr_output_buffer);
+    targets |= LOG_TO_FILE;
   }
 
-  closelog();
+  va_start (args, format);
+  log_vmessage(targets, LOG_NOTICE, DAEMON_NAME, "Dilithium Error: ", ecode, format, args);
+  va_end (args);
 }
 
 /*! \brief General Message function
@@ -91,32 +81,27 @@ void ErrorMessage(const char *format, ...)
  */
 void ShowMessage(const char *format, ...) {
 
-  std::string message;
-
+  int targets = 0;
   va_list args;
-  va_start (args, format);
-  vsnprintf ( ptr_message_buffer, sizeof(message_buffer), format, args);
-  va_end (args);
-
-  message = "Dilithium: ";
-  message.append(ptr_message_buffer);
 
   if (DaemonMode) {
-    openlog("Dilithium", LOG_CONS | LOG_NDELAY | LOG_PERROR | LOG_PID, LOG_USER);
-      syslog(LOG_NOTICE, "%s", message.c_str());
-    closelog();
+    targets = LOG_TO_SYSLOG | LOG_TO_STDERR;
   }
-  else if (!BeQuite) {
-    puts( message.c_str() );
-  }
-  else if (Verbose) {
-    puts( message.c_str() );
+  else if (!BeQuite || Verbose) {
+    targets = LOG_TO_STDOUT;
   }
 
   if ( DilithiumLog ) {
-    Write2Log(message.c_str());
+    targets |= LOG_TO_FILE;
   }
 
+  if ( targets == 0 ) {
+    return;
+  }
+
+  va_start (args, format);
+  log_vmessage(targets, LOG_NOTICE, "Dilithium", "Dilithium: ", 0, format, args);
+  va_end (args);
 }
 
 /*! \brief Return Word Count
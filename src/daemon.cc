@@ -37,49 +37,48 @@
 #include "privileges.h"
 #include "dilithium.h"
 #include "xlogin.h"
+#include "logger.h"
+#include "recorder.h"
 #include "daemon.h"
 
 static sig_atomic_t g_eflag;
 static sig_atomic_t g_hupflag;
 
-char  daemon_buffer[256];
-char *ptr_daemon_buffer = &daemon_buffer[0];
-
 /*! \brief Daemon Log Wrapper
  *  \par Function Description
  *  This function is the only daemon class function to write to the system
- *  log. The function opens and close the log to insure the syslog is not
- *  open when accessing shared library routines.
+ *  log. The message is queued for the logger thread, which owns the
+ *  connection to syslogd, so the log is not opened and closed each time.
  */
 void Daemon::LogMsg (int priority, char* message, char* str1=NULL, char* str2=NULL)
 {
-  /* Set our Logging Mask and open the Log */
-  setlogmask(LOG_UPTO(LOG_INFO));
-
-  openlog(DAEMON_NAME, LOG_DAEMON | LOG_SYSLOG | LOG_PERROR | LOG_PID, LOG_USER);
+  if (priority > LOG_INFO) {
+    return;
+  }
 
   if (str2 != NULL) {
-    syslog (priority, message, str1, str2);
+    log_message (LOG_TO_SYSLOG | LOG_TO_STDERR, priority, DAEMON_NAME, message, str1, str2);
   }
   else if (str1 != NULL) {
-    syslog (priority, message, str1);
+    log_message (LOG_TO_SYSLOG | LOG_TO_STDERR, priority, DAEMON_NAME, message, str1);
   }
   else {
-    syslog (priority, "%s", message);
+    log_message (LOG_TO_SYSLOG | LOG_TO_STDERR, priority, DAEMON_NAME, "%s", message);
   }
-
-  closelog ();
 }
 
 /*! \brief Daemon Log Wrapper Over-load for Integer Formatting 
  *  \par Function Description
- *  This function applies the format for in interger argument using
- *  the snprintf function and passes the resulting composite string
- *  to the main LogMsg function.
+ *  This function applies the format for in interger argument, the
+ *  logger formats it straight into its ring.
  */
 void Daemon::LogMsg (int priority, char* message, int num) {
-  snprintf ( ptr_daemon_buffer, sizeof(ptr_daemon_buffer), message, num);
-  LogMsg(priority, ptr_daemon_buffer);
+
+  if (priority > LOG_INFO) {
+    return;
+  }
+
+  log_message (LOG_TO_SYSLOG | LOG_TO_STDERR, priority, DAEMON_NAME, message, num);
 }
 
 /*! \brief Daemon Resolve File Descriptors
@@ -175,7 +174,7 @@ pid_t Daemon::spawn_gui(void) {
   number_of_client_args = word_count( dilithium->xclientargs);
   number_of_server_args = word_count( dilithium->xserverargs);
 
-  number_of_buffers = 6 + number_of_client_args + number_of_server_args ;
+  number_of_buffers = 8 + number_of_client_args + number_of_server_args ;
 
   argv = (char**) malloc(number_of_buffers * sizeof(char *));
 
@@ -207,6 +206,11 @@ pid_t Daemon::spawn_gui(void) {
 
   argv[index++] = dilithium->display;
 
+  if ( RuntimeAuth && !dilithium->empty(dilithium->xauthority) ) {
+    argv[index++] = (char *) "-auth";
+    argv[index++] = dilithium->xauthority;
+  }
+
   if ( !dilithium->empty(dilithium->xserverargs) ) {
     if ( number_of_server_args > 1 ) {
       Tokenize(dilithium->xserverargs, sa_tokens);
@@ -235,9 +239,11 @@ pid_t Daemon::spawn_gui(void) {
 
   if ( status != 0) {
      syslog (LOG_NOTICE, "posix_spawn: %s", strerror(status));
+     trace_event(TRACE_EXEC_FAILED, status, 0, "xinit");
      r_pid = 0;
   }
   else {
+     trace_event(TRACE_SPAWN, r_pid, 0, "xinit");
      if ( DebugMode || Verbose ) {
        syslog (LOG_NOTICE, "(DEBUG+) Dilithium posix_spawn returned 0");
      }
@@ -370,6 +376,7 @@ void Daemon::Idle() {
         }
         // Look Mom, No breaks!
       case 'N':
+        trace_event(TRACE_EXIT, x_pid, 0);
         LogMsg(LOG_NOTICE, "(DEBUG+) Dilithium X is dead");
         x_pid = 0;
         g_eflag = true;
@@ -387,6 +394,7 @@ void Daemon::Idle() {
   }
 
   if ( KillX && ( x_pid > 0 )) {
+    trace_event(TRACE_KILL, x_pid, SIGTERM);
     if (kill(x_pid, SIGTERM) == 0) {
       LogMsg(LOG_NOTICE, "Dilithium: terminated X");
     }
@@ -450,6 +458,8 @@ int Daemon::becomeDaemon(int flags) {   /* Returns 0 on success, -1 on error */
 
     int maxfd, fd;
 
+    log_flush();                        /* the child has no drain thread */
+
     switch ((pid = fork())) {           /* Become background process */
     case -1: return EXIT_FAILURE;
     case 0:  break;                     /* Child falls through... */
@@ -468,6 +478,9 @@ int Daemon::becomeDaemon(int flags) {   /* Returns 0 on success, -1 on error */
     default: _exit(EXIT_SUCCESS);
     }
 
+    log_restart();
+    trace_event(TRACE_STATE, STATE_DAEMON);
+
     if (!(flags & BD_NO_UMASK0))
         umask(0);                       /* Clear file mode creation mask */
 
@@ -27,7 +27,6 @@
  * \brief and other display managers
  */
 #include "common.h"
-#include <fstream>
 
 #include "global.h"
 #include "privileges.h"
@@ -36,6 +35,9 @@
 #include "daemon.h"
 #include "spawner.h"
 #include "xauthxx.h"
+#include "logger.h"
+#include "recorder.h"
+#include "history.h"
 
 
 #include "console.h"
@@ -46,8 +48,6 @@ extern char **environ;
 
 char *user_buffer;  /* Dynamically allocated for strings in pwd  */
 
-std::ofstream logfile;
-
 const char * const shells[] = {
 
 /* Shells */
@@ -80,36 +80,169 @@ void exit_funtion (void)
   }
 }
 
-void Write2Log(const char* str) {
-    logfile << str << std::endl;
+void Write2Log(const char* format, ...) {
+
+  va_list args;
+
+  if ( !DilithiumLog ) {
+    return;
+  }
+
+  va_start (args, format);
+  log_vmessage(LOG_TO_FILE, LOG_DEBUG, "Dilithium", NULL, 0, format, args);
+  va_end (args);
 }
 
 /*! \brief Create X Authority File
  *  \par Function Description
- *  This function creates an X authority file in the user home directory
- *  if such a file does not already exist.
+ *  This function adds the cookie for the display to the X authority file,
+ *  replacing the old cookie of the same display and dropping the entries
+ *  of local displays that are no longer running. The file is held locked
+ *  from the read to the rename of the new copy.
  */
 bool make_authority(char *xauthfile, char *sdisplay) {
 
   int idisplay;
 
-  idisplay = atoi(sdisplay);
+  idisplay = atoi(sdisplay[0] == ':' ? sdisplay + 1 : sdisplay);
 
   try {
         Xau::XauthList auth_list;
-        auth_list.load_from_file();
+        Xau::XauthList::lock_file(xauthfile);
+
+        try {
+              auth_list.load_from_file(xauthfile, false);
+              auth_list.prune_dead_displays();
+
+              Xau::MagicCookie cookie;
+
+              /* Use Compact Scheme */
+              auth_list.upsert(Xau::Xauth(Xau::LocalAddress(), idisplay, cookie));
+              auth_list.upsert(Xau::Xauth(Xau::InternetAddress(127,0,0,1), idisplay, cookie));
 
-        Xau::MagicCookie cookie;
+              auth_list.write_to_file(xauthfile, false);
+        }
+        catch (...) {
+              Xau::XauthList::unlock_file(xauthfile);
+              throw;
+        }
+
+        Xau::XauthList::unlock_file(xauthfile);
+  }
+  catch (std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return false;
+  }
+  return true;
+}
+
+/*! \brief Runtime Directory
+ *  \par Function Description
+ *  This function finds a local directory private to the user for files
+ *  that only live as long as the session: /run/user/<uid> when the system
+ *  provides it, otherwise /tmp/.dilithium-<uid>, which is created if it
+ *  does not exist and refused if anybody else could have planted it.
+ *
+ *  \retval true if <dir> holds the name of a usable directory.
+ */
+static bool runtime_directory ( uid_t uid, gid_t gid, std::string &dir ) {
+
+  struct stat st;
+  char path[MAX_PATH];
+
+  snprintf(path, sizeof(path), "/run/user/%u", (unsigned) uid);
+
+  if ( stat(path, &st) == NO_ERROR && S_ISDIR(st.st_mode) && st.st_uid == uid ) {
+    dir = path;
+    return true;
+  }
+
+  snprintf(path, sizeof(path), "/tmp/.dilithium-%u", (unsigned) uid);
+
+  if ( mkdir(path, S_IRWXU) == NO_ERROR ) {
+    if ( geteuid() == 0 && chown(path, uid, gid) != NO_ERROR ) {
+      ErrorMessage("could not change owner of <%s>", path);
+      rmdir(path);
+      return false;
+    }
+  }
+  else if ( errno != EEXIST ) {
+    ErrorMessage("could not create <%s>", path);
+    return false;
+  }
+
+  if ( lstat(path, &st) != NO_ERROR || !S_ISDIR(st.st_mode) ||
+       st.st_uid != uid || (st.st_mode & (S_IRWXG | S_IRWXO)) ) {
+    ErrorMessage("refusing to use <%s>, not a private directory", path);
+    return false;
+  }
+
+  dir = path;
+  return true;
+}
+
+/*! \brief Make Runtime Authority
+ *  \par Function Description
+ *  This function writes a new authority file holding only a fresh cookie
+ *  for this display into the runtime directory of <userinfo>, or of the
+ *  current user when nobody has logged in yet. Nothing is read from or
+ *  locked in the home directory, which may be on NFS. When <cookie_from>
+ *  is given the cookie of the display is copied from that file instead,
+ *  this is how the user gets a copy of the file the server was started
+ *  with.
+ *
+ *  \retval true if <authority> holds the name of the new file.
+ */
+static bool make_runtime_authority ( Dilithium *d, std::string &authority,
+                                     const char *cookie_from = NULL ) {
+
+  uid_t uid = d->userinfo ? d->userinfo->pw_uid : getuid();
+  gid_t gid = d->userinfo ? d->userinfo->pw_gid : getgid();
+
+  int idisplay;
+  std::string dir;
+  std::stringstream name;
+
+  idisplay = atoi(d->display[0] == ':' ? d->display + 1 : d->display);
+
+  if ( d->empty(d->xauthority) || cookie_from != NULL ) {
+    if ( !runtime_directory(uid, gid, dir) ) {
+      return false;
+    }
+    name << dir << "/" << XAUTHORITY_FILE << "-" << idisplay;
+    authority = name.str();
+  }
+  else {
+    authority = d->xauthority;             /* command-line */
+  }
+
+  try {
+        Xau::XauthList auth_list;
         Xau::Display display(idisplay);
 
-        /* Use Compact Scheme */
-        auth_list.push_back(Xau::Xauth(Xau::LocalAddress(), idisplay, cookie));
-        auth_list.push_back(Xau::Xauth(Xau::InternetAddress(127,0,0,1), idisplay, cookie));
+        if ( cookie_from != NULL ) {
+          Xau::XauthList server_list;
+          server_list.load_from_file(cookie_from, false);
+
+          std::vector<Xau::Xauth*> found = server_list.select(Xau::XauthCond(display));
+          for (size_t i = 0; i < found.size(); i++) {
+            auth_list.upsert(*found[i]);
+          }
+        }
+        else {
+          Xau::MagicCookie cookie;
 
-        auth_list.write_to_file(xauthfile);
+          /* Use Compact Scheme */
+          auth_list.upsert(Xau::Xauth(Xau::LocalAddress(), display, cookie));
+          auth_list.upsert(Xau::Xauth(Xau::InternetAddress(127,0,0,1), display, cookie));
+        }
 
-        Xau::Xauth auth;
+        /* the file is ours alone, no other process writes it */
+        auth_list.write_to_file(authority, false);
 
+        if ( geteuid() == 0 && chown(authority.c_str(), uid, gid) != NO_ERROR ) {
+          ErrorMessage("could not change owner of <%s>", authority.c_str());
+        }
   }
   catch (std::exception& e) {
       std::cerr << e.what() << std::endl;
@@ -118,6 +251,43 @@ bool make_authority(char *xauthfile, char *sdisplay) {
   return true;
 }
 
+/*! \brief Share Runtime Authority
+ *  \par Function Description
+ *  When the server was started before anybody logged in, its authority
+ *  file belongs to the display manager. This function gives the user who
+ *  just logged in a copy of the cookie in their own runtime directory and
+ *  points XAUTHORITY at it.
+ *
+ *  \retval true if nothing had to be done or the copy was made.
+ */
+bool share_runtime_authority ( Dilithium *d ) {
+
+  std::string authority;
+
+  if ( !RuntimeAuth || d->userinfo == NULL || d->empty(d->xauthority) ) {
+    return true;
+  }
+
+  if ( d->userinfo->pw_uid == getuid() ) {
+    return true;
+  }
+
+  if ( !make_runtime_authority(d, authority, d->xauthority) ) {
+    ErrorMessage("could not give the X authority to <%s>", d->userinfo->pw_name);
+    return false;
+  }
+
+  if ( setenv("XAUTHORITY", authority.c_str(), 1) != NO_ERROR ) {
+    ErrorMessage("setting environment variable XAUTHORITY=%s", authority.c_str());
+    return false;
+  }
+
+  if ( Verbose || DebugMode ) {
+    ShowMessage("set environment variable XAUTHORITY=%s", authority.c_str());
+  }
+  return true;
+}
+
 /*! \brief Show Help function
  *  \par Function Description
  *  This function displays parameter options.
@@ -143,6 +313,14 @@ void ShowHelp(void) {
   printf("      --no-log  Do not create a seperate log, use syslog.\n");
   printf("      --logfile Specify the name log file, default <%s>\n", DILITHIUM_LOGFILE);
   printf("      --xinit   Use xinit to launch X with the client.\n");
+  printf("      --dump-trace [file] Print the flight recorder, default <%s>\n", DILITHIUM_TRACEFILE);
+  printf("      --trace-json [file] Print the last boot in the flight recorder as a\n");
+  printf("                Chrome trace, for chrome://tracing or ui.perfetto.dev\n");
+  printf("      --stats [file] Print the boot history, default <%s>\n", DILITHIUM_HISTORYFILE);
+  printf("      --adaptive-timeout Wait for the X server as long as the boot\n");
+  printf("                history says it needs, instead of fixed delays.\n");
+  printf("      --runtime-auth Write a new authority file for each display in\n");
+  printf("                /run/user/<uid> and pass it to the server with -auth.\n");
   printf("\nNote: All parameters and arguments are case sensitive\n\n");
 }
 
@@ -166,6 +344,8 @@ void ShowUsage(char **argv) {
  */
 bool set_authority ( Dilithium *d ) {
 
+  trace_span span("set-authority");
+
   bool result;
 
   char *xauthfile;
@@ -176,6 +356,24 @@ bool set_authority ( Dilithium *d ) {
 
   result = true;
 
+  if ( RuntimeAuth ) {
+    /* A fresh file for each display, the environment is not inherited
+     * because the server is told to use this very file */
+    if ( !make_runtime_authority(d, authority) ) {
+      return false;
+    }
+    d->set ( d->xauthority, (char*) authority.c_str() );
+
+    if ( (setenv("XAUTHORITY",  d->xauthority, 1)) != NO_ERROR) {
+      ErrorMessage("setting environment variable XAUTHORITY=%s", d->xauthority);
+      return false;
+    }
+    if ( Verbose || DebugMode ) {
+      ShowMessage("set environment variable XAUTHORITY=%s", d->xauthority);
+    }
+    return true;
+  }
+
   if ( d->userinfo != NULL ) {       /* if there is a user name */
     dir = d->userinfo->pw_dir;       /* then try home folder    */
   }
@@ -348,6 +546,8 @@ char get_process_name (pid_t qid, char *buffer)
  */
 ProgramRunMode get_run_mode(Dilithium *dilithium ) {
 
+  trace_span span("get-run-mode");
+
   bool  shell;
   bool  initd;
 
@@ -568,6 +768,11 @@ int use_xinit( Dilithium *d ) {
     argv[index++] = (char *) d->xserver;
     argv[index++] = (char*) d->display;
 
+    if ( RuntimeAuth && !d->empty(d->xauthority) ) {
+      argv[index++] = (char *) "-auth";
+      argv[index++] = (char *) d->xauthority;
+    }
+
     argc = word_count(d->xserverargs);
 
     if ( argc != 0 ) {
@@ -588,7 +793,9 @@ int use_xinit( Dilithium *d ) {
 
     fflush(NULL);
 
+    trace_event(TRACE_EXEC, 0, 0, "xinit");
     execvp(argv[0], argv);
+    trace_event(TRACE_EXEC_FAILED, errno, 0, "xinit");
 
     ErrorMessage( "Failed to execute xinit, Exit." );
   }
@@ -632,6 +839,8 @@ bool set_display( Dilithium *dilithium ) {
  */
 bool set_options( Dilithium *d ) {
 
+  trace_span span("set-options");
+
   char *tmp_str;
   bool result;
 
@@ -749,6 +958,8 @@ int remove_pid_file (const char *filename)
  */
 bool Expell_Old_Daemon (char *name) {
 
+    trace_span span("expell-daemon");
+
     bool result;
     int isSysInit;
     int isRuning;
@@ -891,6 +1102,39 @@ int parse_command_line(int argc, char *argv[], Dilithium *d ) {
            ret_val = 0;
            break;
     }
+    else if (strcmp(argv[i],"--dump-trace")==0) {
+           if ( i + 1 < argc && argv[i+1][0] != '-' ) {
+             trace_dump(argv[++i]);
+           }
+           else {
+             trace_dump();
+           }
+           ret_val = 0;
+           break;
+    }
+    else if (strcmp(argv[i],"--trace-json")==0) {
+           if ( i + 1 < argc && argv[i+1][0] != '-' ) {
+             trace_export(argv[++i]);
+           }
+           else {
+             trace_export();
+           }
+           ret_val = 0;
+           break;
+    }
+    else if (strcmp(argv[i],"--stats")==0) {
+           if ( i + 1 < argc && argv[i+1][0] != '-' ) {
+             history_stats(argv[++i]);
+           }
+           else {
+             history_stats();
+           }
+           ret_val = 0;
+           break;
+    }
+    else if (strcmp(argv[i],"--adaptive-timeout")==0) {
+           AdaptiveTimeout = true;
+    }
     else if (strcmp(argv[i],"--no-log")==0) {
            DilithiumLog = false;
     }
@@ -910,6 +1154,9 @@ int parse_command_line(int argc, char *argv[], Dilithium *d ) {
     else if (strcmp(argv[i],"--xinit")==0) {
            UseXinit = true;
     }
+    else if (strcmp(argv[i],"--runtime-auth")==0) {
+           RuntimeAuth = true;
+    }
     else if ((strcmp(argv[i],"-d")==0) ||
              (strcmp(argv[i],"--debug")==0)) {
            DebugMode = true;
@@ -936,6 +1183,11 @@ int main(int argc, char *argv[]) //,char** envp
 
   char    *me;
   int      exit_code;
+  uint64_t started, parsed;
+
+  /* the recorder is opened once the options are known, so the time
+   * spent on them is kept until then */
+  started = trace_now();
 
   me = basename(argv[0]);
 
@@ -956,13 +1208,24 @@ int main(int argc, char *argv[]) //,char** envp
     }
   }
 
+  parsed = trace_now();
+
   if ( DilithiumLog ) {
     if( dilithium.log_file_name.empty() ) {
       dilithium.log_file_name = DILITHIUM_LOGFILE;
     }
-    logfile.open(dilithium.log_file_name.c_str());
   }
 
+  log_start( DilithiumLog ? dilithium.log_file_name.c_str() : NULL );
+
+  trace_open();
+  trace_event_at(started, TRACE_START, time(NULL), (int) (Version * 100), me);
+  trace_event_at(started, TRACE_BEGIN, 0, 0, "parse-options");
+  trace_event_at(parsed, TRACE_END, 1, 0, "parse-options");
+  trace_event(TRACE_STATE, STATE_BOOT);
+
+  history_open();
+
   if ( !Expell_Old_Daemon (me) ) {
     ErrorMessage("expelling daemons, Exit");
     exit_code = EALREADY;
@@ -977,9 +1240,11 @@ int main(int argc, char *argv[]) //,char** envp
     ErrorMessage("Dilithium Terminating,");
   }
   else if ( !set_authority(&dilithium) ) {
+    trace_event(TRACE_AUTH, 0);
     ErrorMessage("There was a problem setting Xauthority. Is an Xserver already running?");
   }
   else {
+    trace_event(TRACE_AUTH, 1);
 
     C.save_active_vt();
 
@@ -1011,9 +1276,13 @@ int main(int argc, char *argv[]) //,char** envp
     }
   }
 
-  if ( DilithiumLog ) {
-    logfile.close();
-  }
+  history_append((int) (Version * 100));
+
+  trace_event(TRACE_STOP, exit_code);
+  trace_close();
+
+  log_stop();
+
   return exit_code;
 }
 
@@ -1039,6 +1308,7 @@ void Dilithium::initialize()
 
     memset (lockfile,    0, sizeof(string_lockfile));
     memset (unknown,     0, sizeof(string_unknown));
+    memset (xauthority,  0, sizeof(string_xauthority));
     memset (xclient,     0, sizeof(string_xclient));
     memset (xclientargs, 0, sizeof(string_xclientargs));
     memset (xserver,     0, sizeof(string_xserver));
@@ -1054,7 +1324,7 @@ void debug_environment() {
   for (env = environ; *env != 0; env++)
   {
     char* thisEnv = *env;
-    logfile <<  thisEnv << std::endl;
+    Write2Log("%s", thisEnv);
   }
 
 }
@@ -1068,30 +1338,32 @@ void debug_environment() {
  */
 int Dilithium::initialize_user()
 {
+  trace_span span("init-user");
+
   char *user;
   int ret_val = EXIT_SUCCESS;
 
-  logfile << "Begin Dilithium::initialize_user: run_mode=" << run_mode << std::endl;
+  Write2Log("Begin Dilithium::initialize_user: run_mode=%d", run_mode);
   if ( run_mode > RUN_LEVEL ) {
     user = getenv("SUDO_USER");
     if ( user ) {
 
       if ( user_name.empty() ) {
-        logfile << "Dilithium::initialize_user: user_name is empty, set to SUDO_USER=" << user << std::endl;
+        Write2Log("Dilithium::initialize_user: user_name is empty, set to SUDO_USER=%s", user);
         user_name = user;
       }
       else
-        logfile << "Dilithium::initialize_user: user_name=" << user << std::endl;
+        Write2Log("Dilithium::initialize_user: user_name=%s", user);
 
-      logfile << std::endl;
+      Write2Log("");
 
     }
     else {
       if (user_name.empty()) {
-        logfile << "Dilithium::initialize_user: NO USER NAME" << std::endl;
+        Write2Log("Dilithium::initialize_user: NO USER NAME");
       }
       else {
-        logfile << "Dilithium::initialize_user: NO SUDO_USER, user_name=" <<  user_name << std::endl;
+        Write2Log("Dilithium::initialize_user: NO SUDO_USER, user_name=%s", user_name.c_str());
       }
     }
   }
@@ -0,0 +1,82 @@
+/* greeter.cc
+   Loader for the Xlogin dialog module of the Dilithium Program.
+*/
+/**
+ * @par dilithium - GPL Launcher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/*!   @file    greeter.cc C++ Source file for the greeter loader
+ *    @brief   Opens the login dialog module the first time it is needed
+ *
+ * The dialog, with everything it links against (libXrender, libXft,
+ * libjpeg, ...), lives in xlogin.so. Dilithium only opens it when
+ * there is no user to log in, so when started with --user the process
+ * never maps those libraries.
+ */
+#include <dlfcn.h>
+
+#include "common.h"
+#include "privileges.h"
+#include "dilithium.h"
+#include "xlogin.h"
+#include "greeter.h"
+
+static void *module;
+static xlogin_entry entry;
+
+/*! \brief Show the login dialog
+ *  \par Function Description
+ *  Loads the module on the first call and runs the dialog.
+ *
+ * \param dilithium a Dilithium object
+ * \retval int enumerated WhatDoNext, or -1 if the module could not
+ *             be loaded
+ */
+int greeter_login (Dilithium *dilithium)
+{
+  if (!entry) {
+
+    module = dlopen(XLOGIN_MODULE, RTLD_NOW | RTLD_LOCAL);
+
+    if (!module) {
+      ErrorMessage("can't load login dialog: %s", dlerror());
+      return -1;
+    }
+
+    entry = (xlogin_entry) dlsym(module, XLOGIN_ENTRY);
+
+    if (!entry) {
+      ErrorMessage("invalid login dialog module: %s", dlerror());
+      greeter_unload();
+      return -1;
+    }
+  }
+
+  return entry(dilithium);
+}
+
+/*! \brief Unload the dialog module, if it was loaded */
+void greeter_unload (void)
+{
+  if (module) {
+    dlclose(module);
+    module = NULL;
+  }
+  entry = NULL;
+}
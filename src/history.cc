@@ -0,0 +1,280 @@
+/* history.cc
+   Boot History for the Dilithium Program.
+*/
+/**
+ * @par dilithium - GPL Launcher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/**
+ * \defgroup History for Dilithium
+ * \brief
+ *
+ * The durations are not measured again here, they are read back from the
+ * flight recorder when the run ends, so a phase is timed by the same
+ * begin and end records --trace-json shows. The file is opened at start,
+ * while dilithium is still root, and the record is appended with a single
+ * write, so runs on several displays do not mix their records.
+ */
+#include "common.h"
+#include "recorder.h"
+#include "history.h"
+
+#include <fcntl.h>
+#include <algorithm>
+
+static int history_fd = -1;
+
+/* the spans, from the begin of the first to the end of the second */
+static const struct {
+    const char *name;
+    const char *from;
+    const char *to;
+} phases[HISTORY_PHASES] = {
+    { "server-ready", "fork-server",    "waitforserver"   },
+    { "greeter",      "greeter-create", "load-background" },
+    { "auth",         "auth",           "auth"            },
+    { "client",       "fork-client",    "first-map"       },
+    { "shutdown",     "shutdown",       "shutdown"        }
+};
+
+/*! \brief Open the Boot History
+ *  \par Function Description
+ *  This function opens <filename> for appending, creating it and its
+ *  directory if needed. Nothing is recorded without the flight recorder.
+ *
+ *  \retval true if history_append will append this run.
+ */
+bool history_open(const char *filename) {
+
+  std::string directory(filename);
+
+  if ( history_fd >= 0 ) {
+    return true;
+  }
+  if ( !trace_active() ) {
+    return false;
+  }
+
+  directory.erase(directory.rfind('/') == std::string::npos ? 0 : directory.rfind('/'));
+
+  if ( !directory.empty() && mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST ) {
+    return false;
+  }
+
+  history_fd = open(filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+  return history_fd >= 0;
+}
+
+/*! \brief Record this Run
+ *  \par Function Description
+ *  This function appends the phases this run went through and closes
+ *  the history. A run that went through none, like --xinit, is left out.
+ */
+void history_append(int version) {
+
+  history_record record;
+  bool any = false;
+
+  if ( history_fd < 0 ) {
+    return;
+  }
+
+  memset(&record, 0, sizeof(record));
+
+  record.magic   = HISTORY_MAGIC;
+  record.version = version;
+  record.time    = time(NULL);
+
+  for ( int i = 0; i < HISTORY_PHASES; i++ ) {
+
+    int64_t ns = trace_interval(phases[i].from, phases[i].to);
+
+    record.ms[i] = ns < 0 ? HISTORY_NONE : (uint32_t) ((ns + 500000) / 1000000);
+    any = any || ns >= 0;
+  }
+
+  if ( any && write(history_fd, &record, sizeof(record)) != sizeof(record) ) {
+    ErrorMessage("could not record boot history");
+  }
+
+  close(history_fd);
+  history_fd = -1;
+}
+
+static bool not_a_record(const history_record &r) {
+  return r.magic != HISTORY_MAGIC;
+}
+
+/*! \brief Read the Boot History
+ *  \par Function Description
+ *  This function reads the last <most> records of <filename>, or all of
+ *  them if <most> is 0, skipping anything that is not a record.
+ */
+static bool read_history(const char *filename, size_t most,
+                         std::vector<history_record> &records) {
+
+  struct stat st;
+  off_t start;
+  int fd;
+
+  fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+  if ( fd < 0 || fstat(fd, &st) < 0 ) {
+    if ( fd >= 0 ) close(fd);
+    return false;
+  }
+
+  size_t count = st.st_size / sizeof(history_record);
+
+  start = ( most != 0 && count > most ) ? (off_t) ((count - most) * sizeof(history_record)) : 0;
+  count = ( most != 0 && count > most ) ? most : count;
+
+  records.resize(count);
+
+  if ( count == 0 ) {
+    close(fd);
+    return true;
+  }
+
+  ssize_t got = pread(fd, &records[0], count * sizeof(history_record), start);
+  close(fd);
+
+  records.resize(got < 0 ? 0 : got / sizeof(history_record));
+
+  records.erase(std::remove_if(records.begin(), records.end(), not_a_record),
+                records.end());
+
+  return true;
+}
+
+/* nearest rank, <values> sorted */
+static uint32_t percentile(const std::vector<uint32_t> &values, int p) {
+
+  size_t rank = ( values.size() * p + 99 ) / 100;
+
+  return values[rank > 0 ? rank - 1 : 0];
+}
+
+static std::vector<uint32_t> durations(const std::vector<history_record> &records,
+                                       size_t first, size_t last, int phase) {
+
+  std::vector<uint32_t> values;
+
+  for ( size_t i = first; i < last; i++ ) {
+    if ( records[i].ms[phase] != HISTORY_NONE ) {
+      values.push_back(records[i].ms[phase]);
+    }
+  }
+  std::sort(values.begin(), values.end());
+
+  return values;
+}
+
+/*! \brief Learned Timeout
+ *  \par Function Description
+ *  This function returns twice the 99th percentile of <phase> over the
+ *  last HISTORY_BASELINE boots, in whole seconds between <floor> and
+ *  <ceiling>. With fewer than HISTORY_MIN_BOOTS boots it returns
+ *  <ceiling>, the fixed timeout it replaces.
+ */
+int history_timeout(int phase, int floor, int ceiling, const char *filename) {
+
+  std::vector<history_record> records;
+
+  if ( !read_history(filename, HISTORY_BASELINE, records) ) {
+    return ceiling;
+  }
+
+  std::vector<uint32_t> values = durations(records, 0, records.size(), phase);
+
+  if ( values.size() < HISTORY_MIN_BOOTS ) {
+    return ceiling;
+  }
+
+  int seconds = ( 2 * percentile(values, 99) + 999 ) / 1000;
+
+  return std::min(std::max(seconds, floor), ceiling);
+}
+
+/*! \brief Print the Boot History
+ *  \par Function Description
+ *  This function prints the 50th, 95th and 99th percentiles of every
+ *  phase over all recorded boots, and flags a phase whose median over the
+ *  last HISTORY_RECENT boots is HISTORY_REGRESSION percent or more of its
+ *  median over the HISTORY_BASELINE boots before them.
+ *
+ *  \retval EXIT_SUCCESS, or EXIT_FAILURE if there is no history.
+ */
+int history_stats(const char *filename) {
+
+  std::vector<history_record> records;
+  char first[32], last[32];
+  time_t when;
+
+  if ( !read_history(filename, 0, records) || records.empty() ) {
+    fprintf(stderr, "%s: no boots recorded\n", filename);
+    return EXIT_FAILURE;
+  }
+
+  when = records.front().time;
+  strftime(first, sizeof(first), "%Y-%m-%d", localtime(&when));
+  when = records.back().time;
+  strftime(last, sizeof(last), "%Y-%m-%d", localtime(&when));
+
+  printf("%zu boots recorded, %s to %s\n", records.size(), first, last);
+  printf("%-14s %7s %8s %8s %8s  %10s %10s\n",
+         "phase", "boots", "p50 ms", "p95 ms", "p99 ms", "recent p50", "base p50");
+
+  size_t recent   = records.size() > HISTORY_RECENT ? records.size() - HISTORY_RECENT : 0;
+  size_t baseline = recent > HISTORY_BASELINE ? recent - HISTORY_BASELINE : 0;
+
+  for ( int i = 0; i < HISTORY_PHASES; i++ ) {
+
+    std::vector<uint32_t> all  = durations(records, 0, records.size(), i);
+    std::vector<uint32_t> now  = durations(records, recent, records.size(), i);
+    std::vector<uint32_t> base = durations(records, baseline, recent, i);
+
+    if ( all.empty() ) {
+      printf("%-14s %7d\n", phases[i].name, 0);
+      continue;
+    }
+
+    printf("%-14s %7zu %8u %8u %8u", phases[i].name, all.size(),
+           percentile(all, 50), percentile(all, 95), percentile(all, 99));
+
+    if ( now.empty() || base.size() < HISTORY_MIN_BOOTS ) {
+      printf("\n");
+      continue;
+    }
+
+    uint32_t now_p50  = percentile(now, 50);
+    uint32_t base_p50 = percentile(base, 50);
+
+    printf("  %10u %10u", now_p50, base_p50);
+
+    if ( now_p50 * 100 >= base_p50 * HISTORY_REGRESSION &&
+         now_p50 - base_p50 > HISTORY_NOISE ) {
+      printf("  REGRESSION +%u%%", ( now_p50 - base_p50 ) * 100 / std::max(base_p50, 1u));
+    }
+    printf("\n");
+  }
+
+  return EXIT_SUCCESS;
+}
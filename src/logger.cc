@@ -0,0 +1,564 @@
+/* logger.cc
+   Asynchronous Logger for the Dilithium Program.
+*/
+/**
+ * @par dilithium - GPL Launcher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/**
+ * \defgroup Logger for Dilithium
+ * \brief
+ *
+ * The ring is a bounded multi-producer queue: every slot carries a
+ * sequence number telling whose turn it is, a producer claims a position
+ * with one compare-and-swap and publishes the slot by bumping its
+ * sequence. The only consumer is the drain thread, which takes up to
+ * LOG_BATCH published slots at a time and hands them to writev(2) for
+ * the file and the console and to sendmmsg(2) for /dev/log.
+ */
+#include "common.h"
+#include "logger.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define SYSLOG_SOCKET  "/dev/log"
+#define WAKE_TIMEOUT   1000     /* ms, the drain thread sleeps at most this */
+
+struct log_slot {
+  unsigned long sequence;
+  int           targets;
+  int           priority;
+  const char   *ident;
+  time_t        when;
+  char          text[LOG_TEXT_SIZE];
+};
+
+static log_slot ring[LOG_SLOTS];
+
+static unsigned long enqueue_pos;
+static unsigned long dequeue_pos;
+static unsigned long written_pos;
+static unsigned long dropped;
+
+static int sleeping;
+static int stopping;
+
+static bool      running   = false;
+static pid_t     owner     = 0;
+static pthread_t drainer;
+
+static int wake_pipe[2] = { -1, -1 };
+static int log_fd       = -1;
+static int syslog_fd    = -1;
+
+static char newline[] = "\n";
+
+/*! \brief Connect to the System Log
+ *  \par Function Description
+ *  This function opens a datagram socket to syslogd, so the drain thread
+ *  can send it a batch of messages at once.
+ *
+ *  \retval descriptor of the socket, or -1 if syslogd does not listen.
+ */
+static int connect_syslog(void) {
+
+  struct sockaddr_un addr;
+  int fd;
+
+  fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+  if ( fd < 0 ) {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, SYSLOG_SOCKET, sizeof(addr.sun_path) - 1);
+
+  if ( connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/*! \brief Write Vector Completely
+ *  \par Function Description
+ *  This function calls writev until every byte in <iov> is written,
+ *  or the descriptor fails.
+ */
+static void write_all(int fd, struct iovec *iov, int count) {
+
+  while ( count > 0 ) {
+
+    ssize_t n = writev(fd, iov, count);
+
+    if ( n < 0 ) {
+      if ( errno == EINTR ) continue;
+      return;
+    }
+
+    while ( count > 0 && (size_t) n >= iov->iov_len ) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+
+    if ( count > 0 ) {
+      iov->iov_base = (char*) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+/*! \brief Send Batch to the System Log
+ *  \par Function Description
+ *  This function sends one datagram per message to syslogd, with the
+ *  header syslog(3) would have put in front of it. If the socket went
+ *  away, because syslogd restarted, it is reconnected once and then the
+ *  messages go through syslog(3).
+ */
+static void send_syslog(log_slot **slots, int count) {
+
+  struct mmsghdr msgs[LOG_BATCH];
+  struct iovec   iov[2 * LOG_BATCH];
+  char           headers[LOG_BATCH][64];
+  int            sent;
+
+  memset(msgs, 0, sizeof(msgs[0]) * count);
+
+  for ( int i = 0; i < count; i++ ) {
+
+    struct tm tm;
+    char stamp[32];
+
+    localtime_r(&slots[i]->when, &tm);
+    strftime(stamp, sizeof(stamp), "%b %e %H:%M:%S", &tm);
+
+    iov[2*i].iov_base   = headers[i];
+    iov[2*i].iov_len    = snprintf(headers[i], sizeof(headers[i]), "<%d>%s %s[%d]: ",
+                                   LOG_USER | slots[i]->priority, stamp,
+                                   slots[i]->ident, (int) getpid());
+    iov[2*i+1].iov_base = slots[i]->text;
+    iov[2*i+1].iov_len  = strlen(slots[i]->text);
+
+    msgs[i].msg_hdr.msg_iov    = &iov[2*i];
+    msgs[i].msg_hdr.msg_iovlen = 2;
+  }
+
+  for ( int attempt = 0; attempt < 2 && syslog_fd >= 0; attempt++ ) {
+
+    sent = 0;
+    while ( sent < count ) {
+      int n = sendmmsg(syslog_fd, msgs + sent, count - sent, 0);
+      if ( n < 0 && errno == EINTR ) continue;
+      if ( n <= 0 ) break;
+      sent += n;
+    }
+
+    if ( sent == count ) {
+      return;
+    }
+
+    slots += sent;
+    count -= sent;
+    memmove(msgs, msgs + sent, sizeof(msgs[0]) * count);
+
+    close(syslog_fd);
+    syslog_fd = connect_syslog();
+  }
+
+  for ( int i = 0; i < count; i++ ) {
+    syslog(slots[i]->priority, "%s", slots[i]->text);
+  }
+}
+
+/*! \brief Write a Batch of Messages
+ *  \par Function Description
+ *  This function writes <count> messages to every place they are meant
+ *  for, with one system call per place.
+ */
+static void emit(log_slot **slots, int count) {
+
+  struct iovec file_iov[2 * LOG_BATCH];
+  struct iovec err_iov[2 * LOG_BATCH];
+  struct iovec out_iov[2 * LOG_BATCH];
+  log_slot    *sys[LOG_BATCH];
+
+  int nfile = 0, nerr = 0, nout = 0, nsys = 0;
+
+  for ( int i = 0; i < count; i++ ) {
+
+    log_slot *s = slots[i];
+    size_t length = strlen(s->text);
+
+    if ( (s->targets & LOG_TO_FILE) && log_fd >= 0 ) {
+      file_iov[nfile].iov_base   = s->text;
+      file_iov[nfile++].iov_len  = length;
+      file_iov[nfile].iov_base   = newline;
+      file_iov[nfile++].iov_len  = 1;
+    }
+    if ( s->targets & LOG_TO_STDERR ) {
+      err_iov[nerr].iov_base     = s->text;
+      err_iov[nerr++].iov_len    = length;
+      err_iov[nerr].iov_base     = newline;
+      err_iov[nerr++].iov_len    = 1;
+    }
+    if ( s->targets & LOG_TO_STDOUT ) {
+      out_iov[nout].iov_base     = s->text;
+      out_iov[nout++].iov_len    = length;
+      out_iov[nout].iov_base     = newline;
+      out_iov[nout++].iov_len    = 1;
+    }
+    if ( s->targets & LOG_TO_SYSLOG ) {
+      sys[nsys++] = s;
+    }
+  }
+
+  if ( nfile ) write_all(log_fd, file_iov, nfile);
+  if ( nerr )  write_all(STDERR_FILENO, err_iov, nerr);
+  if ( nout )  write_all(STDOUT_FILENO, out_iov, nout);
+  if ( nsys )  send_syslog(sys, nsys);
+}
+
+/*! \brief Fill a Slot
+ *  \par Function Description
+ *  This function formats a message into the fixed size text of <s>,
+ *  truncating it if it does not fit. Nothing is allocated.
+ */
+static void fill(log_slot *s, int targets, int priority, const char *ident,
+                 const char *prefix, int ecode, const char *format, va_list args) {
+
+  size_t size = sizeof(s->text);
+  int n = 0;
+
+  s->targets  = targets;
+  s->priority = priority;
+  s->ident    = ident;
+  s->when     = time(NULL);
+
+  if ( prefix ) {
+    n = snprintf(s->text, size, "%s", prefix);
+    if ( n < 0 ) n = 0;
+    if ( (size_t) n >= size ) n = size - 1;
+  }
+
+  int m = vsnprintf(s->text + n, size - n, format, args);
+  if ( m > 0 ) n += m;
+  if ( (size_t) n >= size ) n = size - 1;
+
+  if ( ecode != 0 ) {
+    snprintf(s->text + n, size - n, " %s", strerror(ecode));
+  }
+}
+
+static void wake_drainer(void) {
+
+  char c = 0;
+
+  if ( write(wake_pipe[1], &c, 1) < 0 ) {
+    /* the pipe is full, so the drainer is awake anyway */
+  }
+}
+
+/*! \brief Drain Thread
+ *  \par Function Description
+ *  This function takes the published slots off the ring in order, writes
+ *  them in batches and gives the slots back. When the ring is empty it
+ *  sleeps on the wake pipe, which a producer only writes to when it sees
+ *  the drainer asleep.
+ */
+static void *drain(void *) {
+
+  log_slot      *batch[LOG_BATCH];
+  unsigned long  position[LOG_BATCH];
+
+  for (;;) {
+
+    int n = 0;
+    unsigned long pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+
+    while ( n < LOG_BATCH ) {
+      log_slot *s = &ring[pos & (LOG_SLOTS - 1)];
+      if ( __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE) != pos + 1 ) break;
+      position[n] = pos;
+      batch[n++]  = s;
+      pos++;
+    }
+
+    if ( n > 0 ) {
+      __atomic_store_n(&dequeue_pos, pos, __ATOMIC_RELAXED);
+
+      emit(batch, n);
+
+      for ( int i = 0; i < n; i++ ) {
+        __atomic_store_n(&batch[i]->sequence, position[i] + LOG_SLOTS, __ATOMIC_RELEASE);
+      }
+      __atomic_store_n(&written_pos, pos, __ATOMIC_RELEASE);
+      continue;
+    }
+
+    if ( __atomic_load_n(&stopping, __ATOMIC_ACQUIRE) ) {
+      break;
+    }
+
+    __atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if ( __atomic_load_n(&ring[pos & (LOG_SLOTS - 1)].sequence, __ATOMIC_ACQUIRE) != pos + 1 &&
+         !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE) ) {
+
+      struct pollfd pfd;
+      char buffer[64];
+
+      pfd.fd      = wake_pipe[0];
+      pfd.events  = POLLIN;
+      pfd.revents = 0;
+
+      poll(&pfd, 1, WAKE_TIMEOUT);
+
+      while ( read(wake_pipe[0], buffer, sizeof(buffer)) > 0 ) {
+      }
+    }
+
+    __atomic_store_n(&sleeping, 0, __ATOMIC_SEQ_CST);
+  }
+
+  return NULL;
+}
+
+/*! \brief Start the Drain Thread
+ *  \par Function Description
+ *  Signals stay with the main thread: the spawner waits for SIGUSR1 and
+ *  SIGALRM with sigsuspend, so the drain thread blocks all of them.
+ */
+static bool start_thread(void) {
+
+  sigset_t all, old;
+
+  for ( int i = 0; i < LOG_SLOTS; i++ ) {
+    ring[i].sequence = i;
+  }
+  enqueue_pos = dequeue_pos = written_pos = 0;
+  sleeping = stopping = 0;
+
+  if ( pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) < 0 ) {
+    return false;
+  }
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+
+  int status = pthread_create(&drainer, NULL, drain, NULL);
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if ( status != 0 ) {
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    wake_pipe[0] = wake_pipe[1] = -1;
+    return false;
+  }
+
+  owner   = getpid();
+  running = true;
+
+  return true;
+}
+
+/*! \brief Start Logging
+ *  \par Function Description
+ *  This function opens (and truncates) the log file <filename>, if any,
+ *  connects to syslogd and starts the drain thread.
+ *
+ *  \retval true if messages are now written in the background.
+ */
+bool log_start(const char *filename) {
+
+  if ( running ) {
+    return true;
+  }
+
+  if ( filename != NULL ) {
+    log_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  }
+
+  syslog_fd = connect_syslog();
+
+  return start_thread();
+}
+
+/*! \brief Stop Logging
+ *  \par Function Description
+ *  This function waits for the drain thread to write what is left in the
+ *  ring, reports how many messages were dropped and closes everything.
+ */
+void log_stop(void) {
+
+  if ( running && owner == getpid() ) {
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    wake_drainer();
+    pthread_join(drainer, NULL);
+
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    wake_pipe[0] = wake_pipe[1] = -1;
+
+    running = false;
+  }
+
+  if ( dropped ) {
+    log_message(LOG_TO_FILE | LOG_TO_STDERR, LOG_NOTICE, "Dilithium",
+                "Dilithium: %lu log messages were dropped", dropped);
+  }
+
+  if ( log_fd >= 0 ) {
+    close(log_fd);
+    log_fd = -1;
+  }
+  if ( syslog_fd >= 0 ) {
+    close(syslog_fd);
+    syslog_fd = -1;
+  }
+}
+
+/*! \brief Flush the Log
+ *  \par Function Description
+ *  This function waits, for at most a second, until every message queued
+ *  so far is written. Call it before fork(), the child gets a copy of the
+ *  ring but not the thread that empties it.
+ */
+void log_flush(void) {
+
+  if ( !running || owner != getpid() ) {
+    return;
+  }
+
+  wake_drainer();
+
+  for ( int i = 0; i < 1000; i++ ) {
+    if ( __atomic_load_n(&written_pos, __ATOMIC_ACQUIRE) ==
+         __atomic_load_n(&enqueue_pos, __ATOMIC_ACQUIRE) ) {
+      return;
+    }
+    usleep(1000);
+  }
+}
+
+/*! \brief Restart Logging After fork()
+ *  \par Function Description
+ *  This function gives a forked child, the daemon, a drain thread of its
+ *  own. Until it is called the child writes its messages synchronously.
+ */
+void log_restart(void) {
+
+  if ( !running || owner == getpid() ) {
+    return;
+  }
+
+  running = false;
+
+  if ( wake_pipe[0] >= 0 ) close(wake_pipe[0]);
+  if ( wake_pipe[1] >= 0 ) close(wake_pipe[1]);
+  wake_pipe[0] = wake_pipe[1] = -1;
+
+  start_thread();
+}
+
+/*! \brief Queue a Message
+ *  \par Function Description
+ *  This function formats <prefix>, <format> and, if <ecode> is not zero,
+ *  the text of that error number into a free slot of the ring. If there
+ *  is none the message is dropped and counted, the caller never waits.
+ *
+ *  \retval false if the message was dropped.
+ */
+bool log_vmessage(int targets, int priority, const char *ident,
+                  const char *prefix, int ecode,
+                  const char *format, va_list args) {
+
+  if ( !running || owner != getpid() ) {
+    log_slot s;
+    log_slot *p = &s;
+
+    fill(&s, targets, priority, ident, prefix, ecode, format, args);
+    emit(&p, 1);
+    return true;
+  }
+
+  unsigned long pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+  log_slot *s;
+
+  for (;;) {
+    s = &ring[pos & (LOG_SLOTS - 1)];
+
+    long diff = (long) __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE) - (long) pos;
+
+    if ( diff == 0 ) {
+      if ( __atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, true,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED) ) {
+        break;
+      }
+    }
+    else if ( diff < 0 ) {
+      __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+      return false;
+    }
+    else {
+      pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  fill(s, targets, priority, ident, prefix, ecode, format, args);
+
+  __atomic_store_n(&s->sequence, pos + 1, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if ( __atomic_load_n(&sleeping, __ATOMIC_SEQ_CST) &&
+       __atomic_exchange_n(&sleeping, 0, __ATOMIC_SEQ_CST) ) {
+    wake_drainer();
+  }
+
+  return true;
+}
+
+bool log_message(int targets, int priority, const char *ident,
+                 const char *format, ... ) {
+
+  bool result;
+  va_list args;
+
+  va_start (args, format);
+  result = log_vmessage(targets, priority, ident, NULL, 0, format, args);
+  va_end (args);
+
+  return result;
+}
+
+unsigned long log_dropped(void) {
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,544 @@
+/* recorder.cc
+   Flight Recorder for the Dilithium Program.
+*/
+/**
+ * @par dilithium - GPL Launcher for FVWM-CRYSTAL
+ *
+ * Copyright (C) 2013 dilithium Contributors (see ChangeLog for details)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110
+ * -1301 USA
+ */
+/**
+ * \defgroup Recorder for Dilithium
+ * \brief
+ *
+ * The file is a trace_header, padded to TRACE_DATA_OFFSET, followed by
+ * TRACE_RECORDS trace_records. A writer claims a position with an atomic
+ * add on the header's head, clears the record's sequence, fills it in
+ * and stores the sequence last, so --dump-trace can tell a record that
+ * was being written when the process died from a complete one. Forked
+ * children share the mapping until they exec, and trace_event is async
+ * signal safe.
+ */
+#include "common.h"
+#include "recorder.h"
+
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define TRACE_DATA_OFFSET  64
+#define TRACE_FILE_SIZE    (TRACE_DATA_OFFSET + TRACE_RECORDS * sizeof(trace_record))
+
+static trace_header *header  = NULL;
+static trace_record *records = NULL;
+
+static const char *event_names[] = {
+    "?", "start", "spawn", "exec", "exec-failed", "exit", "signal",
+    "kill", "state", "ready", "auth", "login", "stop", "begin", "end", "x-requests"
+};
+
+static const char *state_names[] = {
+    "?", "boot", "server-starting", "server-ready", "greeter",
+    "session", "shutdown", "daemon"
+};
+
+static bool valid_header(const trace_header *h) {
+  return memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) == 0 &&
+         h->record_size == sizeof(trace_record) &&
+         h->records == TRACE_RECORDS;
+}
+
+/*! \brief Open the Flight Recorder
+ *  \par Function Description
+ *  This function maps <filename>, creating it or starting it over if it
+ *  was not a trace of this layout. Without the file nothing is recorded
+ *  and trace_event costs a test of a pointer.
+ *
+ *  \retval true if events are now recorded.
+ */
+bool trace_open(const char *filename) {
+
+  struct stat st;
+  void *map;
+  int fd;
+
+  if ( header != NULL ) {
+    return true;
+  }
+
+  fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+
+  if ( fd < 0 ) {
+    return false;
+  }
+
+  if ( fstat(fd, &st) < 0 ||
+       ( (size_t) st.st_size != TRACE_FILE_SIZE &&
+         ftruncate(fd, TRACE_FILE_SIZE) < 0 ) ) {
+    close(fd);
+    return false;
+  }
+
+  map = mmap(NULL, TRACE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if ( map == MAP_FAILED ) {
+    return false;
+  }
+
+  header  = (trace_header*) map;
+  records = (trace_record*) ((char*) map + TRACE_DATA_OFFSET);
+
+  if ( !valid_header(header) ) {
+    memset(map, 0, TRACE_FILE_SIZE);
+    header->record_size = sizeof(trace_record);
+    header->records     = TRACE_RECORDS;
+    memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+  }
+
+  return true;
+}
+
+void trace_close(void) {
+
+  if ( header != NULL ) {
+    munmap(header, TRACE_FILE_SIZE);
+    header  = NULL;
+    records = NULL;
+  }
+}
+
+bool trace_active(void) {
+  return header != NULL;
+}
+
+uint64_t trace_now(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*! \brief Record an Event
+ *  \par Function Description
+ *  This function appends one record to the ring. It only uses an atomic
+ *  add, clock_gettime and plain stores, so it may be called from signal
+ *  handlers and between fork and exec.
+ */
+void trace_event(int event, int a, int b, const char *tag) {
+
+  if ( header != NULL ) {
+    trace_event_at(trace_now(), event, a, b, tag);
+  }
+}
+
+/*! \brief Record an Event that Happened Earlier
+ *  \par Function Description
+ *  This function is trace_event with the time given by the caller, for
+ *  what happened before the recorder was opened.
+ */
+void trace_event_at(uint64_t time, int event, int a, int b, const char *tag) {
+
+  trace_record *r;
+  uint64_t position;
+
+  if ( header == NULL ) {
+    return;
+  }
+
+  position = __atomic_fetch_add(&header->head, 1, __ATOMIC_RELAXED);
+  r = &records[position % TRACE_RECORDS];
+
+  __atomic_store_n(&r->sequence, 0, __ATOMIC_RELAXED);
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+  r->time  = time;
+  r->event = event;
+  r->pid   = getpid();
+  r->a     = a;
+  r->b     = b;
+
+  int i = 0;
+  if ( tag != NULL ) {
+    for ( ; i < TRACE_TAG_SIZE - 1 && tag[i]; i++ ) {
+      r->tag[i] = tag[i];
+    }
+  }
+  r->tag[i] = '\0';
+
+  __atomic_store_n(&r->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+/*! \brief Time Between two Phases of this Run
+ *  \par Function Description
+ *  This function looks back through the records of this process, up to
+ *  its start record, for the last completed end of the phase <to> and
+ *  the begin of the phase <from> before it.
+ *
+ *  \retval nanoseconds from the one to the other, or -1 if either phase
+ *          did not happen or gave up.
+ */
+int64_t trace_interval(const char *from, const char *to) {
+
+  uint64_t head, first, end = 0;
+  const char *wanted = to;
+  pid_t pid = getpid();
+
+  if ( header == NULL ) {
+    return -1;
+  }
+
+  head  = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+  first = head > TRACE_RECORDS ? head - TRACE_RECORDS : 0;
+
+  for ( uint64_t position = head; position > first; position-- ) {
+
+    const trace_record *r = &records[(position - 1) % TRACE_RECORDS];
+
+    if ( __atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE) != position ||
+         r->pid != pid ) {
+      continue;
+    }
+    if ( r->event == TRACE_START ) {
+      break;
+    }
+    if ( strncmp(r->tag, wanted, TRACE_TAG_SIZE - 1) != 0 ) {
+      continue;
+    }
+    if ( end == 0 && r->event == TRACE_END ) {
+      if ( !r->a ) {
+        return -1;
+      }
+      end = r->time;
+      wanted = from;
+    }
+    else if ( end != 0 && r->event == TRACE_BEGIN ) {
+      return end - r->time;
+    }
+  }
+
+  return -1;
+}
+
+/*! \brief Find the Last Record of an Event
+ *  \par Function Description
+ *  This function copies the last complete record of <event> tagged <tag>
+ *  that this process wrote since its start record into <record>.
+ *
+ *  \retval true if there is one.
+ */
+bool trace_find(int event, const char *tag, trace_record *record) {
+
+  uint64_t head, first;
+  pid_t pid = getpid();
+
+  if ( header == NULL ) {
+    return false;
+  }
+
+  head  = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+  first = head > TRACE_RECORDS ? head - TRACE_RECORDS : 0;
+
+  for ( uint64_t position = head; position > first; position-- ) {
+
+    const trace_record *r = &records[(position - 1) % TRACE_RECORDS];
+
+    if ( __atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE) != position ||
+         r->pid != pid ) {
+      continue;
+    }
+    if ( r->event == event && strncmp(r->tag, tag, TRACE_TAG_SIZE - 1) == 0 ) {
+      *record = *r;
+      return true;
+    }
+    if ( r->event == TRACE_START ) {
+      break;
+    }
+  }
+
+  return false;
+}
+
+/*! \brief Describe the Arguments of a Record
+ *  \par Function Description
+ *  This function writes the a and b fields of <r> into <text> the way
+ *  its event uses them.
+ */
+static void describe(const trace_record *r, char *text, size_t size) {
+
+  text[0] = '\0';
+
+  switch ( r->event ) {
+  case TRACE_START:
+    {
+      time_t when = r->a;
+      char stamp[32];
+      strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&when));
+      snprintf(text, size, "%s version %d", stamp, r->b);
+    }
+    break;
+  case TRACE_SPAWN:
+    snprintf(text, size, "pid %d", r->a);
+    break;
+  case TRACE_EXEC_FAILED:
+    snprintf(text, size, "%s", strerror(r->a));
+    break;
+  case TRACE_EXIT:
+    if ( WIFEXITED(r->b) )
+      snprintf(text, size, "pid %d exit %d", r->a, WEXITSTATUS(r->b));
+    else if ( WIFSIGNALED(r->b) )
+      snprintf(text, size, "pid %d killed by %s", r->a, strsignal(WTERMSIG(r->b)));
+    else
+      snprintf(text, size, "pid %d status %#x", r->a, r->b);
+    break;
+  case TRACE_SIGNAL:
+    snprintf(text, size, "%s", strsignal(r->a));
+    break;
+  case TRACE_KILL:
+    snprintf(text, size, "pid %d %s", r->a, strsignal(r->b));
+    break;
+  case TRACE_STATE:
+    snprintf(text, size, "%s", ( r->a > 0 && r->a <= STATE_DAEMON ) ? state_names[r->a] : "?");
+    break;
+  case TRACE_READY:
+    snprintf(text, size, "%s after %d ms", r->a ? "connected" : "gave up", r->b);
+    break;
+  case TRACE_AUTH:
+    snprintf(text, size, "%s", r->a ? "ok" : "failed");
+    break;
+  case TRACE_LOGIN:
+  case TRACE_STOP:
+    snprintf(text, size, "%d", r->a);
+    break;
+  case TRACE_END:
+    snprintf(text, size, "%s", r->a ? "" : "gave up");
+    break;
+  case TRACE_XSTATS:
+    snprintf(text, size, "%d requests, %d round trips", r->a, r->b);
+    break;
+  default:
+    break;
+  }
+}
+
+static const char *event_name(const trace_record *r) {
+  return r->event < sizeof(event_names) / sizeof(event_names[0]) ? event_names[r->event] : "?";
+}
+
+/*! \brief Map a Trace for Reading
+ *  \par Function Description
+ *  This function maps <filename> read only, or complains and returns
+ *  NULL if it is not a trace of this layout.
+ */
+static const trace_header *map_trace(const char *filename) {
+
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+  if ( fd < 0 || fstat(fd, &st) < 0 || (size_t) st.st_size != TRACE_FILE_SIZE ) {
+    fprintf(stderr, "%s: not a dilithium trace\n", filename);
+    if ( fd >= 0 ) close(fd);
+    return NULL;
+  }
+
+  map = mmap(NULL, TRACE_FILE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if ( map == MAP_FAILED || !valid_header((trace_header*) map) ) {
+    fprintf(stderr, "%s: not a dilithium trace\n", filename);
+    if ( map != MAP_FAILED ) munmap(map, TRACE_FILE_SIZE);
+    return NULL;
+  }
+
+  return (const trace_header*) map;
+}
+
+static const trace_record *complete_record(const trace_header *h, uint64_t position) {
+
+  const trace_record *rs = (const trace_record*) ((const char*) h + TRACE_DATA_OFFSET);
+  const trace_record *r  = &rs[position % TRACE_RECORDS];
+
+  if ( __atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE) != position + 1 ) {
+    return NULL;
+  }
+  return r;
+}
+
+/*! \brief Dump the Flight Recorder
+ *  \par Function Description
+ *  This function prints the records still in the ring, oldest first,
+ *  with the time since the start record before them. A record the
+ *  writer never finished is marked torn.
+ *
+ *  \retval EXIT_SUCCESS, or EXIT_FAILURE if the file is not a trace.
+ */
+int trace_dump(const char *filename) {
+
+  const trace_header *h = map_trace(filename);
+  char text[128];
+
+  if ( h == NULL ) {
+    return EXIT_FAILURE;
+  }
+
+  uint64_t head  = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+  uint64_t first = head > TRACE_RECORDS ? head - TRACE_RECORDS : 0;
+  uint64_t base  = 0;
+  uint64_t last  = 0;
+
+  printf("%llu events recorded, showing %llu\n",
+         (unsigned long long) head, (unsigned long long) (head - first));
+  printf("%12s %10s %7s  %-12s %-15s\n", "ms", "+ms", "pid", "event", "tag");
+
+  for ( uint64_t position = first; position < head; position++ ) {
+
+    const trace_record *r = complete_record(h, position);
+
+    if ( r == NULL ) {
+      printf("%12s %10s %7s  torn\n", "-", "-", "-");
+      continue;
+    }
+
+    /* time restarts at every start record, and after a reboot */
+    if ( r->event == TRACE_START || base == 0 || r->time < last ) {
+      base = r->time;
+      last = r->time;
+      printf("\n");
+    }
+
+    describe(r, text, sizeof(text));
+
+    printf("%12.3f %10.3f %7d  %-12s %-15s %s\n",
+           (r->time - base) / 1e6, (r->time - last) / 1e6, r->pid,
+           event_name(r), r->tag, text);
+
+    last = r->time;
+  }
+
+  munmap((void*) h, TRACE_FILE_SIZE);
+
+  return EXIT_SUCCESS;
+}
+
+/* the tags are program and phase names, only quotes and controls need care */
+static void json_string(const char *s) {
+
+  putchar('"');
+  for ( ; *s; s++ ) {
+    if ( *s == '"' || *s == '\\' )
+      printf("\\%c", *s);
+    else if ( (unsigned char) *s < ' ' )
+      printf("\\u%04x", *s);
+    else
+      putchar(*s);
+  }
+  putchar('"');
+}
+
+/*! \brief Export the Last Boot as a Chrome Trace
+ *  \par Function Description
+ *  This function prints the records from the last start record on in the
+ *  Chrome trace event format, which chrome://tracing and the Perfetto UI
+ *  load as a timeline. Spans become duration events on the track of the
+ *  process that recorded them, everything else an instant event with its
+ *  description, and spawned processes are named after their program.
+ *
+ *  \retval EXIT_SUCCESS, or EXIT_FAILURE if the file is not a trace.
+ */
+int trace_export(const char *filename) {
+
+  const trace_header *h = map_trace(filename);
+  const trace_record *r;
+  const char *separator = "\n";
+  char text[128];
+
+  if ( h == NULL ) {
+    return EXIT_FAILURE;
+  }
+
+  uint64_t head  = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+  uint64_t first = head > TRACE_RECORDS ? head - TRACE_RECORDS : 0;
+  uint64_t start = first;
+
+  for ( uint64_t position = head; position > first; position-- ) {
+    r = complete_record(h, position - 1);
+    if ( r != NULL && r->event == TRACE_START ) {
+      start = position - 1;
+      break;
+    }
+  }
+
+  uint64_t base = 0;
+
+  printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  for ( uint64_t position = start; position < head; position++ ) {
+
+    if ( ( r = complete_record(h, position) ) == NULL ) {
+      continue;
+    }
+    if ( base == 0 ) {
+      base = r->time;
+    }
+    if ( r->time < base ) {     /* from before a reboot */
+      continue;
+    }
+
+    printf("%s{\"name\":", separator);
+    separator = ",\n";
+
+    switch ( r->event ) {
+    case TRACE_BEGIN:
+    case TRACE_END:
+      json_string(r->tag);
+      if ( r->event == TRACE_BEGIN )
+        printf(",\"ph\":\"B\"");
+      else
+        printf(",\"ph\":\"E\",\"args\":{\"done\":%s}", r->a ? "true" : "false");
+      break;
+    default:
+      describe(r, text, sizeof(text));
+      json_string(event_name(r));
+      printf(",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"tag\":");
+      json_string(r->tag);
+      printf(",\"detail\":");
+      json_string(text);
+      printf("}");
+      break;
+    }
+
+    printf(",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", (r->time - base) / 1e3, r->pid, r->pid);
+
+    if ( r->event == TRACE_START || r->event == TRACE_SPAWN ) {
+      printf(",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":",
+             r->event == TRACE_START ? r->pid : r->a);
+      json_string(r->tag);
+      printf("}}");
+    }
+  }
+
+  printf("\n]}\n");
+
+  munmap((void*) h, TRACE_FILE_SIZE);
+
+  return EXIT_SUCCESS;
+}
@@ -32,9 +32,13 @@
 #include "privileges.h"
 #include "dilithium.h"
 #include "xlogin.h"
+#include "greeter.h"
+#include "recorder.h"
+#include "history.h"
 #include "spawner.h"
 
 #include <sys/resource.h>
+#include <poll.h>
 
 static char *clientargv[50];
 static char *serverargv[100];
@@ -45,11 +49,12 @@ static void sigCatch(int sig)
 {
   /* On system with POSIX signals, just interrupt the system call */
   gotSignal = sig;
+  trace_event(TRACE_SIGNAL, sig);
 }
 
 static void sigIgnore(int sig)
 {
-
+  trace_event(TRACE_SIGNAL, sig);
 }
 
 int Spawner::start_client()
@@ -62,6 +67,10 @@ int Spawner::start_client()
 
   std::vector<std::string> ca_tokens;
 
+  watch_first_map();
+
+  trace_event(TRACE_BEGIN, 0, 0, "fork-client");
+
   cid = fork();
 
   switch(cid) {
@@ -108,16 +117,23 @@ int Spawner::start_client()
 
     fflush(NULL);
 
+    trace_event(TRACE_EXEC, 0, 0, prog);
     execvp(argv[0], argv);
+    trace_event(TRACE_EXEC_FAILED, errno, 0, prog);
 
     ErrorMessage("Unable to run program \"%s\"", dilithium->xclient);
 
     return EXIT_FAILURE;
     break;
   case -1:
+    trace_event(TRACE_END, 0, 0, "fork-client");
+    wait_first_map();
     ErrorMessage("Unable to run program \"%s\"", dilithium->xclient);
     break;
   default:
+    trace_event(TRACE_END, 1, 0, "fork-client");
+    trace_event(TRACE_SPAWN, cid, 0, basename(dilithium->xclient));
+    trace_event(TRACE_STATE, STATE_SESSION);
     errno = 0;
   } /* End Select Case */
   return cid;
@@ -133,8 +149,10 @@ bool Spawner::process_timeout(int timeout, char *string)
 
     for (;;) {
 
-        if ((pidfound = waitpid(sid, &status, WNOHANG)) == sid)
+        if ((pidfound = waitpid(sid, &status, WNOHANG)) == sid) {
+            trace_event(TRACE_EXIT, sid, status);
             break;
+        }
         if (timeout) {
             if (i == 0 && string != laststring)
                 fprintf(stderr, "\r\nwaiting for %s ", string);
@@ -155,12 +173,19 @@ bool Spawner::process_timeout(int timeout, char *string)
 /*  waitforserver - wait for X server to start up */
 bool Spawner::waitforserver( const char *displayNum)
 {
-  int    ncycles  = BOOT_TIME; /* # of cycles to wait */
+  int    ncycles;              /* # of cycles to wait */
   int    cycles;               /* Wait cycle count */
 
+  trace_span span("waitforserver");
+
+  ncycles = AdaptiveTimeout ?
+            history_timeout(PHASE_SERVER_READY, 2 * SERVER_BOOT_DELAY, BOOT_TIME) :
+            BOOT_TIME;
+
   for (cycles = 0; cycles < ncycles; cycles++) {
     if ((xd = XOpenDisplay(displayNum))) {
 
+      trace_event(TRACE_READY, 1, cycles * 1000);
       return true;
     }
     else {
@@ -169,11 +194,74 @@ bool Spawner::waitforserver( const char *displayNum)
     }
   }
 
+  trace_event(TRACE_READY, 0, cycles * 1000);
+  span.done = false;
   ErrorMessage("giving up");
 
   return false;
 }
 
+/*! \brief Spawner Watch for the First Client Window
+ *  \par Function Description
+ *  When the flight recorder is on, this function starts the first-map
+ *  span and asks the server for the windows mapped on the root from now
+ *  on. start_client calls it before the fork so no map is missed.
+ */
+void Spawner::watch_first_map()
+{
+  if ( xd != NULL && trace_active() ) {
+    XSelectInput(xd, DefaultRootWindow(xd), SubstructureNotifyMask);
+    XSync(xd, False);
+    trace_event(TRACE_BEGIN, 0, 0, "first-map");
+  }
+}
+
+/*! \brief Spawner Wait for the First Client Window
+ *  \par Function Description
+ *  This function ends the first-map span when the client maps its first
+ *  window, gives up after FIRST_MAP_TIMEOUT or when a signal arrived,
+ *  and leaves a client or server that exited meanwhile for the wait()
+ *  in do_spawn to collect.
+ */
+void Spawner::wait_first_map()
+{
+  struct pollfd fds;
+  siginfo_t     info;
+  XEvent        event;
+  int           waited;
+  bool          mapped;
+
+  if ( xd == NULL || !trace_active() ) {
+    return;
+  }
+
+  fds.fd     = ConnectionNumber(xd);
+  fds.events = POLLIN;
+  mapped     = false;
+
+  for ( waited = 0; !mapped && waited < FIRST_MAP_TIMEOUT * 1000; waited += 100 ) {
+
+    info.si_pid = 0;
+    if ( gotSignal != 0 ||
+         waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0 ||
+         info.si_pid != 0 ) {
+      break;
+    }
+
+    if ( poll(&fds, 1, 100) > 0 ) {
+      while ( !mapped && XPending(xd) ) {
+        XNextEvent(xd, &event);
+        mapped = ( event.type == MapNotify );
+      }
+    }
+  }
+
+  trace_event(TRACE_END, mapped, 0, "first-map");
+
+  XSelectInput(xd, DefaultRootWindow(xd), NoEventMask);
+  XFlush(xd);
+}
+
 static int
 ignorexio(Display *dpy)
 {
@@ -197,6 +285,8 @@ int Spawner::start_server()
   sigaddset(&mask, SIGUSR1);
   sigprocmask(SIG_BLOCK, &mask, &old);
 
+  trace_event(TRACE_BEGIN, 0, 0, "fork-server");
+
   sid = fork();
 
   switch(sid) {
@@ -221,6 +311,11 @@ int Spawner::start_server()
     argv[index++] = (char*) prog;
     argv[index++] = (char*) dilithium->display;
 
+    if ( RuntimeAuth && !dilithium->empty(dilithium->xauthority) ) {
+      argv[index++] = (char*) "-auth";
+      argv[index++] = dilithium->xauthority;
+    }
+
     if ( strlen(dilithium->xserverargs) != 0 ) {
       if ( argc > 1 ) {
         Tokenize(dilithium->xserverargs, sa_tokens);
@@ -243,7 +338,9 @@ int Spawner::start_server()
      * if client is xterm -L */
     setpgid(0,getpid());
 
+    trace_event(TRACE_EXEC, 0, 0, prog);
     execvp(argv[0], argv);
+    trace_event(TRACE_EXEC_FAILED, errno, 0, prog);
 
     ErrorMessage("unable to run server \"%s\"", dilithium->xserver);
 
@@ -252,9 +349,14 @@ int Spawner::start_server()
     break;
 
   case -1:
+    trace_event(TRACE_END, 0, 0, "fork-server");
     break;
 
   default:
+    trace_event(TRACE_END, 1, 0, "fork-server");
+    trace_event(TRACE_SPAWN, sid, 0, basename(dilithium->xserver));
+    trace_event(TRACE_STATE, STATE_SERVER_STARTING);
+
     /* don't nice server */
     setpriority(PRIO_PROCESS, sid, -1);
 
@@ -269,14 +371,19 @@ int Spawner::start_server()
      * the 15 second timeout, or await SIGUSR1.
      *
      * If your machine is substantially slower than 5 seconds,
-     * you can easily adjust this value.
+     * you can easily adjust this value, or let --adaptive-timeout
+     * learn it from the boot history.
      */
-     alarm(SERVER_BOOT_DELAY);
+     trace_event(TRACE_BEGIN, 0, 0, "sigusr1-wait");
+
+     alarm(AdaptiveTimeout ?
+           history_timeout(PHASE_SERVER_READY, 1, SERVER_BOOT_DELAY) :
+           SERVER_BOOT_DELAY);
 
      sigsuspend(&old);
 
-     /* Cancel the alarm signal */
-     alarm(0);
+     /* Cancel the alarm signal, what is left of it says SIGUSR1 came */
+     trace_event(TRACE_END, alarm(0) > 0, 0, "sigusr1-wait");
 
      sigprocmask(SIG_SETMASK, &old, NULL);
 
@@ -284,6 +391,9 @@ int Spawner::start_server()
        ErrorMessage("unable to connect to X server");
        sid = -1;
      }
+     else {
+       trace_event(TRACE_STATE, STATE_SERVER_READY);
+     }
 
      break;
   }
@@ -298,11 +408,16 @@ int Spawner::start_server()
  */
 int Spawner::shutdown() {
 
+  trace_span span("shutdown");
+
+  trace_event(TRACE_STATE, STATE_SHUTDOWN);
+
   if (cid > 0) {
 
     XSetIOErrorHandler(ignorexio);
 
     /* HUP all local clients to allow them to clean up */
+    trace_event(TRACE_KILL, cid, SIGHUP);
     if (killpg(cid, SIGHUP) < 0 && errno != ESRCH) {
       ErrorMessage("can't send HUP to process group %d", cid);
     }
@@ -311,7 +426,9 @@ int Spawner::shutdown() {
   if (sid < 0) {
     return sid;
   }
-  else if (killpg(sid, SIGTERM) < 0) {
+  trace_event(TRACE_KILL, sid, SIGTERM);
+
+  if (killpg(sid, SIGTERM) < 0) {
     if (errno == ESRCH)
       return EXIT_FAILURE;
     ErrorMessage("can't kill X server");
@@ -322,6 +439,7 @@ int Spawner::shutdown() {
   }
 
   ErrorMessage("X server slow to shut down, sending KILL signal");
+  trace_event(TRACE_KILL, sid, SIGKILL);
 
   if (killpg(sid, SIGKILL) < 0) {
     if (errno == ESRCH) {
@@ -342,20 +460,27 @@ int Spawner::do_spawn (bool wait_for_kill) {
   bool done;
   int exit_code;
   int pid;
+  int status;
+  int response;
 
   if (( sid = start_server()) > 0 ) {
     if ( dilithium->user_name.empty() ) {
       done = false;
-      Xlogin *dialog = new Xlogin(dilithium);
       while (!done) {
-        switch ( dialog->login()) {
+        trace_event(TRACE_STATE, STATE_GREETER);
+        response = greeter_login(dilithium);
+        trace_event(TRACE_LOGIN, response);
+        switch ( response ) {
           case Login:
             dilithium->run_mode == XLOGIN;
             if ( dilithium->initialize_user() == EXIT_SUCCESS ) {
+              share_runtime_authority(dilithium);
               if (( cid = start_client()) > 0 ) {
+                wait_first_map();
                 pid = -1;
                 while (pid != cid && pid != sid && gotSignal == 0 ) {
-                  pid = wait(NULL);
+                  pid = wait(&status);
+                  if (pid > 0) trace_event(TRACE_EXIT, pid, status);
                 }
               }
             }
@@ -381,11 +506,13 @@ int Spawner::do_spawn (bool wait_for_kill) {
             break;
         }
       }
-      delete dialog;
+      greeter_unload();
       exit_code = shutdown();
     }
     else if (( cid = start_client()) > 0 ) {
 
+      wait_first_map();
+
       if ( wait_for_kill && Verbose ) {
         syslog (LOG_NOTICE, "Waiting to kill server pid=<%d> and client pid=<%d>", sid, cid);
       }
@@ -396,7 +523,8 @@ int Spawner::do_spawn (bool wait_for_kill) {
       if ( wait_for_kill ) {
         pid = -1;
         while (pid != cid && pid != sid && gotSignal == 0 ) {
-          pid = wait(NULL);
+          pid = wait(&status);
+          if (pid > 0) trace_event(TRACE_EXIT, pid, status);
         }
         exit_code = shutdown();
       }
@@ -28,9 +28,16 @@
 #include <sys/stat.h>
 
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <cerrno>
+
+#ifdef HAVE_SYS_RANDOM_H
+# include <sys/random.h>
+#endif
 
 #include "global.h"
 #include "xauthxx.h"
@@ -114,39 +121,100 @@ const std::string Cookie::as_text() const
 
 /******************************************************************************/
 
-/* class MagicCookie */
+/* class RandomPool */
 
-const Token MagicCookie::NAME(MAGIC_COOKIE_NAME, std::strlen(MAGIC_COOKIE_NAME));
+unsigned char RandomPool::pool[RandomPool::POOL_SIZE];
+size_t RandomPool::available = 0;
+pid_t RandomPool::owner = 0;
 
-MagicCookie::MagicCookie()
-    : Cookie(0, 0)
+/* Fills the whole pool, from getrandom(2) where the kernel has it, else
+ * /dev/urandom, and as a last resort libgcrypt if it was configured in */
+void RandomPool::refill()
 {
+    size_t got = 0;
+
+#ifdef HAVE_GETRANDOM
+    while (got < sizeof(pool)) {
+        ssize_t n = getrandom(pool + got, sizeof(pool) - got, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;              /* ENOSYS on old kernels */
+        }
+        got += n;
+    }
+#endif
+
+    if (got < sizeof(pool)) {
+        int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            while (got < sizeof(pool)) {
+                ssize_t n = read(fd, pool + got, sizeof(pool) - got);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;
+                got += n;
+            }
+            close(fd);
+        }
+    }
+
 #ifdef HAVE_GCRYPT
-    char buf[16];
+    if (got < sizeof(pool) && gcry_check_version(NULL)) {
+        gcry_control(GCRYCTL_DISABLE_SECMEM, 0);
+        gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+        gcry_randomize(pool + got, sizeof(pool) - got, GCRY_STRONG_RANDOM);
+        got = sizeof(pool);
+    }
+#endif
 
-     /* Version check is required to intialize  libgcrypt */
-       if (!gcry_check_version (NULL)) {
-           fputs ("error initializing libgcrypt\n", stderr);
-       }
-       else {
+    if (got < sizeof(pool)) {
+        available = 0;
+        throw Error(ERROR_INVALID_COOKIE, "no source of random bytes for the magic cookie");
+    }
 
-         /* Disable secure memory.  */
-         gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+    available = sizeof(pool);
+    owner = getpid();
+}
 
-         /* Tell Libgcrypt that initialization has completed. */
-         gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+void RandomPool::get(char* buf, size_t length)
+{
+    if (owner != getpid()) {
+        std::memset(pool, 0, sizeof(pool));
+        available = 0;
+    }
 
-         gcry_md_hash_buffer(GCRY_MD_MD5, buf,
-                             gcry_random_bytes(sizeof(buf),
-                            GCRY_WEAK_RANDOM), sizeof(buf));
-       }
+    while (length > 0) {
+        if (available == 0)
+            refill();
 
-       assign(buf, sizeof(buf));
+        size_t n = length < available ? length : available;
+        unsigned char* p = pool + sizeof(pool) - available;
 
-#else
-    throw Error(ERROR_INVALID_COOKIE,
-        "recompile with libgcrypt to enable automatic magic cookie generation");
-#endif
+        std::memcpy(buf, p, n);
+        std::memset(p, 0, n);
+
+        available -= n;
+        buf += n;
+        length -= n;
+    }
+}
+
+/******************************************************************************/
+
+/* class MagicCookie */
+
+const Token MagicCookie::NAME(MAGIC_COOKIE_NAME, std::strlen(MAGIC_COOKIE_NAME));
+
+MagicCookie::MagicCookie()
+    : Cookie(0, 0)
+{
+    char buf[16];
+
+    RandomPool::get(buf, sizeof(buf));
+    assign(buf, sizeof(buf));
+    std::memset(buf, 0, sizeof(buf));
 }
 
 MagicCookie::MagicCookie(const std::string& str)
@@ -229,8 +297,9 @@ const std::string Xau::Xauth::as_text() const
     _auth.address           = const_cast<char*>(address->data());
     _auth.number_length     = display->length();
     _auth.number            = const_cast<char*>(display->data());
-    _auth.name_length       = cookie->name().length();
-    _auth.name              = const_cast<char*>(cookie->name().data());
+    _name                   = cookie->name();
+    _auth.name_length       = _name.length();
+    _auth.name              = const_cast<char*>(_name.data());
     _auth.data_length       = cookie->length();
     _auth.data              = const_cast<char*>(cookie->data());
     return &_auth;
@@ -251,42 +320,229 @@ void XauthList::unlock_file(const std::string& filename)
     XauUnlockAuth(filename.c_str());
 }
 
-void XauthList::load_from_file(const std::string& filename)
+XauthList::Key::Key(const Xau::Xauth& auth)
+    : family(auth.address->family()),
+      address(*auth.address),
+      display(*auth.display),
+      name(auth.cookie->name())
+{
+}
+
+bool XauthList::Key::operator<(const Key& k) const
+{
+    if (family != k.family) return family < k.family;
+    if (address != k.address) return address < k.address;
+    if (display != k.display) return display < k.display;
+    return name < k.name;
+}
+
+void XauthList::add(const Xau::Xauth& auth)
+{
+    size_t i = entries.size();
+
+    entries.push_back(auth);
+    by_key.insert(std::make_pair(Key(auth), i));
+    by_display.insert(std::make_pair(std::string(*auth.display), i));
+}
+
+void XauthList::reindex()
+{
+    by_key.clear();
+    by_display.clear();
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        by_key.insert(std::make_pair(Key(entries[i]), i));
+        by_display.insert(std::make_pair(std::string(*entries[i].display), i));
+    }
+}
+
+void XauthList::clear()
+{
+    entries.clear();
+    by_key.clear();
+    by_display.clear();
+}
+
+bool XauthList::upsert(const Xau::Xauth& auth)
+{
+    std::map<Key, size_t>::iterator it = by_key.find(Key(auth));
+
+    if (it == by_key.end()) {
+        add(auth);
+        return true;
+    }
+
+    entries[it->second].cookie = *auth.cookie;
+    return false;
+}
+
+std::vector<Xau::Xauth*> XauthList::select(const XauthCond& cond)
 {
-    lock_file(filename);
+    std::vector<Xau::Xauth*> found;
+    const Display* display = cond.display();
+
+    if (display) {
+        typedef std::multimap<std::string, size_t>::iterator index_iterator;
+        std::pair<index_iterator, index_iterator> range =
+            by_display.equal_range(*display);
+
+        for (index_iterator it = range.first; it != range.second; it++)
+            if (cond(entries[it->second]))
+                found.push_back(&entries[it->second]);
+    }
+    else {
+        for (iterator it = begin(); it != end(); it++)
+            if (cond(*it))
+                found.push_back(&*it);
+    }
+
+    return found;
+}
+
+void XauthList::remove(const XauthCond& cond)
+{
+    std::vector<Xau::Xauth> kept;
+
+    for (iterator it = begin(); it != end(); it++)
+        if (!cond(*it))
+            kept.push_back(*it);
+
+    if (kept.size() != entries.size()) {
+        entries.swap(kept);
+        reindex();
+    }
+}
+
+/* A local display is alive while its socket exists or the pid in its lock
+ * file is running. Only this host's entries are judged, the others may
+ * belong to NFS shared homes or ssh forwarding. */
+static bool display_alive(const std::string& display)
+{
+    struct stat st;
+
+    if (stat(("/tmp/.X11-unix/X" + display).c_str(), &st) == 0)
+        return true;
+
+    FILE* file = fopen(("/tmp/.X" + display + "-lock").c_str(), "r");
+    if (file == NULL)
+        return false;
+
+    long pid = 0;
+    bool alive = fscanf(file, "%ld", &pid) == 1 && pid > 0
+        && (kill((pid_t) pid, 0) == 0 || errno == EPERM);
+
+    fclose(file);
+    return alive;
+}
+
+size_t XauthList::prune_dead_displays()
+{
+    std::vector<Xau::Xauth> kept;
+    std::map<std::string, bool> alive;
+    const std::string host = LocalAddress::hostname();
+
+    for (iterator it = begin(); it != end(); it++) {
+        if (it->address->family() == FAMILY_LOCAL
+            && std::string(*it->address) == host) {
+            std::string display(*it->display);
+
+            if (alive.find(display) == alive.end())
+                alive[display] = display_alive(display);
+
+            if (!alive[display])
+                continue;
+        }
+        kept.push_back(*it);
+    }
+
+    size_t removed = entries.size() - kept.size();
+
+    if (removed) {
+        entries.swap(kept);
+        reindex();
+    }
+
+    return removed;
+}
+
+void XauthList::load_from_file(const std::string& filename, bool lock)
+{
+    if (lock)
+        lock_file(filename);
 
     FILE* file;
-    if ((file = fopen(filename.c_str(), "rb")) == NULL)
+    if ((file = fopen(filename.c_str(), "rb")) == NULL) {
+        int err = errno;
+        if (lock)
+            unlock_file(filename);
+        if (err == ENOENT)
+            return;
         throw Error(ERROR_FILE_ERROR, "cannot open " + filename + " for reading");
+    }
 
+    // the first of duplicate entries wins, like in libXau's lookups
     ::Xauth* auth;
     while ((auth = XauReadAuth(file)) != NULL) {
-        push_back(auth);
+        Xau::Xauth entry(auth);
+        if (by_key.find(Key(entry)) == by_key.end())
+            add(entry);
         XauDisposeAuth(auth);
     }
 
     fclose(file);
 
-    unlock_file(filename);
+    if (lock)
+        unlock_file(filename);
 }
 
-void XauthList::write_to_file(const std::string& filename)
+void XauthList::write_to_file(const std::string& filename, bool lock)
 {
-    lock_file(filename);
+    if (lock)
+        lock_file(filename);
+
+    std::string tmpname = filename + ".XXXXXX";
+    std::vector<char> tmpl(tmpname.begin(), tmpname.end());
+    tmpl.push_back('\0');
+
+    int fd = mkstemp(&tmpl[0]);
+    tmpname = &tmpl[0];
+
+    bool ok = fd >= 0;
+    FILE* file = NULL;
+
+    if (ok) {
+        // mkstemp gives 0600; keep the owner of the file being replaced
+        struct stat st;
+        if (stat(filename.c_str(), &st) == 0 && fchown(fd, st.st_uid, st.st_gid) != 0)
+            ok = false;
+        if (ok && fchmod(fd, S_IRUSR | S_IWUSR) != 0)
+            ok = false;
+        if (ok && (file = fdopen(fd, "wb")) == NULL)
+            ok = false;
+    }
 
-    FILE* file;
-    if ((file = fopen(filename.c_str(), "wb")) == NULL)
-        throw Error(ERROR_FILE_ERROR, "cannot open " + filename + " for writing");
+    for (iterator it = begin(); ok && it != end(); it++)
+        ok = XauWriteAuth(file, *it) != 0;
 
-    // set file permissions
-    chmod(filename.c_str(), S_IRUSR | S_IWUSR);
+    if (ok)
+        ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
 
-    for (iterator it = begin(); it != end(); it++)
-        XauWriteAuth(file, *it);
+    if (file)
+        ok = (fclose(file) == 0) && ok;
+    else if (fd >= 0)
+        close(fd);
 
-    fclose(file);
+    if (ok)
+        ok = rename(tmpname.c_str(), filename.c_str()) == 0;
 
-    unlock_file(filename);
+    if (!ok && fd >= 0)
+        unlink(tmpname.c_str());
+
+    if (lock)
+        unlock_file(filename);
+
+    if (!ok)
+        throw Error(ERROR_FILE_ERROR, "cannot write " + filename);
 }
 
 /******************************************************************************/
@@ -306,9 +562,16 @@ XauthCond::~XauthCond()
         delete *it;
 }
 
-bool XauthCond::operator()(const Xau::Xauth& auth)
+bool XauthCond::operator()(const Xau::Xauth& auth) const
 {
-    for (std::list<XauthCondAtom*>::iterator it = conds.begin(); it != conds.end(); it++)
+    for (std::list<XauthCondAtom*>::const_iterator it = conds.begin(); it != conds.end(); it++)
         if (!(*it)->check(auth)) return false;
     return true;
 }
+
+const Display* XauthCond::display() const
+{
+    for (std::list<XauthCondAtom*>::const_iterator it = conds.begin(); it != conds.end(); it++)
+        if ((*it)->display()) return (*it)->display();
+    return 0;
+}
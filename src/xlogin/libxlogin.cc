@@ -59,6 +59,7 @@ const char *helvetica = "-*-helvetica-*-r-*-*-14-*-*-*-*-*-*-*";
 #include "colors.h"
 #include "xjpeg.h"
 #include "xlogin.h"
+#include "recorder.h"
 
 static int login_answer;
 static char user[MAXUSERNAMESIZE];
@@ -192,6 +193,9 @@ public:
 
      XStoreName( m_display, m_window, "Dilithium Login");
 
+     /* the widgets are mapped together once all of them exist */
+     get_display().begin_map_batch ( m_window );
+
      m_username = new username_text_box ( *this );
      m_password = new password_text_box ( *this );
 
@@ -200,6 +204,8 @@ public:
      m_reboot   = new reboot_button ( *this );
      m_shutdown = new shutdown_button ( *this );
 
+     get_display().end_map_batch();
+
      focus_username(); /*set inital focus */
   }
   ~login_window(){
@@ -346,6 +352,8 @@ private:
  */
 int login_window::auth()
 {
+  trace_span span("auth");
+
   struct passwd *pw;
   struct spwd *sp;
 
@@ -614,6 +622,8 @@ void Xlogin::setup_display()
 
 int Xlogin::load_background()
 {
+   trace_span span("load-background");
+
    int didxcreate = false;
    int sucess     = false;
    const char *filename;
@@ -636,6 +646,33 @@ int Xlogin::load_background()
 
    return sucess;
 }
+/*! \brief Report the X Protocol Costs of the Dialog
+ *  \par Function Description
+ *  This function logs the requests, round trips and output of every
+ *  scope the display counted, and of the whole dialog, and puts requests
+ *  and round trips into the flight recorder, so --trace-json shows them
+ *  next to the phases and a change in round trips stands out in review.
+ */
+static void report_x_costs ( display& d )
+{
+  const std::map<std::string, scope_stats>& scopes = d.scope_report();
+  std::map<std::string, scope_stats>::const_iterator it;
+  flush_stats total = d.total_stats();
+
+  for ( it = scopes.begin(); it != scopes.end(); it++ ) {
+
+    const flush_stats& c = it->second.cost;
+
+    syslog(LOG_INFO, "X costs of %s: %lu calls, %lu requests, %lu round trips, %lu writes, %lu bytes",
+           it->first.c_str(), it->second.calls, c.requests, c.round_trips, c.writes, c.bytes);
+    trace_event(TRACE_XSTATS, c.requests, c.round_trips, it->first.c_str());
+  }
+
+  syslog(LOG_INFO, "X costs of the dialog: %lu frames, %lu requests, %lu round trips, %lu writes, %lu bytes",
+         d.frames(), total.requests, total.round_trips, total.writes, total.bytes);
+  trace_event(TRACE_XSTATS, total.requests, total.round_trips, "greeter");
+}
+
 /*! \brief Xlogin Class Module Entry
  *  \par Function Description
  *  This function is the main entry point for this compilation unit
@@ -657,9 +694,13 @@ int Xlogin::login()
   login_answer = -1;
 
   try {
+      trace_event(TRACE_BEGIN, 0, 0, "greeter-create");
+
       display d (dilithium->display);
       m_display = d;
 
+      d.begin_scope ( "login_window" );
+
       color background( d, MAIN_WINDOW_BG_COLOR);
 
       event_dispatcher events ( d );
@@ -673,8 +714,20 @@ int Xlogin::login()
       xdepth = w.get_depth();
 
       setup_display();
+
+      d.end_scope();
+
+      trace_event(TRACE_END, 1, 0, "greeter-create");
+
+      d.begin_scope ( "load_background" );
       load_background();
+      d.end_scope();
+
+      d.begin_scope ( "event_loop" );
       events.run();
+      d.end_scope();
+
+      report_x_costs ( d );
   }
   catch ( exception_with_text& e ) {
       std::cout << "Exception: " << e.what() << "\n";
@@ -687,6 +740,24 @@ int Xlogin::login()
   return login_answer;
 }
 
+/*!@par Entry point of the xlogin.so module
+ * @note Called by greeter_login in the Dilithium program, every time the
+ *       dialog is to be shown */
+extern "C" int xlogin_run(Dilithium *dilithium)
+{
+  Xlogin dialog(dilithium);
+  int response;
+
+  /* the module has its own copy of the recorder, mapping the same file */
+  trace_open();
+
+  response = dialog.login();
+
+  trace_close();
+
+  return response;
+}
+
 /*!@par Xlogin helper to close the dialog from an external routine
  * @note This is not used by the Dilithium program */
 void Xlogin::close()
@@ -52,7 +52,7 @@ void convert_for_16 ();
 void convert_for_32 ();
 
 unsigned short int *buffer_16bpp;
-long *buffer_32bpp;
+unsigned int *buffer_32bpp;      /* 4 bytes a pixel, not a long */
 
 void convert_for_16 (int w, int x, int y, int r, int g, int b)
 {
@@ -148,17 +148,19 @@ XImage* jpeg_decode (const char filename[], Display *display, int xdepth,
    cinfo.do_block_smoothing = false;
    jpeg_start_decompress (&cinfo);
 
+   width = cinfo.output_width;
+   height = cinfo.output_height;
+
    /* When the jpeg routines get a garbage header they leave width and
     * height containing any old shit, often a very large number */
    if ((cinfo.output_width>1280)|(cinfo.output_height>1280)) {
 
       /* Set dummy values - the code is committed to allocating buffers
-       * and create XImages */
-      cinfo.output_width  = 320;
-      cinfo.output_height = 256;
+       * and create XImages. Only the image is clamped, cinfo keeps the
+       * real size, libjpeg still writes whole rows into the row buffer */
+      width  = 320;
+      height = 256;
    }
-   width = cinfo.output_width;
-   height = cinfo.output_height;
 
    if (cinfo.output_components>4) {
       cinfo.output_components=4;
@@ -184,7 +186,7 @@ XImage* jpeg_decode (const char filename[], Display *display, int xdepth,
          store_data = &convert_for_32;
 
          /* Alocate memory for 32 bit image image */
-         buffer_32bpp = (long*) malloc (width * height * 4);
+         buffer_32bpp = (unsigned int *) malloc (width * height * 4);
          xim=XCreateImage (display, CopyFromParent, xdepth, ZPixmap, 0,
                            (char *) buffer_32bpp, width, height, 32, width * 4);
          *didxcreate=true;
@@ -194,7 +196,7 @@ XImage* jpeg_decode (const char filename[], Display *display, int xdepth,
          if (xdepth == 32) {
 
             store_data = &convert_for_32;
-            buffer_32bpp = (long*) malloc (width * height * 4);
+            buffer_32bpp = (unsigned int *) malloc (width * height * 4);
             xim=XCreateImage (display, CopyFromParent, xdepth, ZPixmap, 0,
                               (char *) buffer_32bpp, width, height, 32, width * 4);
             *didxcreate=true;
@@ -216,18 +218,22 @@ XImage* jpeg_decode (const char filename[], Display *display, int xdepth,
 
    bpix = cinfo.output_components;
 
-   while (cinfo.output_scanline < cinfo.output_height) {
+   while (cinfo.output_scanline < (JDIMENSION) height) {
 
       jpeg_read_scanlines (&cinfo, buffer, 1);
       a = 0;
 
-      for (i = 0; i < bpix * cinfo.output_width; i += bpix) {
+      for (i = 0; i < bpix * width; i += bpix) {
          (*store_data) (width, a, g, buffer[0][i], buffer[0][i + 1], buffer[0][i + 2]);
          a++;
       }
       g++;
    }
-   jpeg_finish_decompress (&cinfo);
+
+   /* A clamped image leaves rows unread, finish would complain */
+   if (cinfo.output_scanline == cinfo.output_height) {
+      jpeg_finish_decompress (&cinfo);
+   }
    jpeg_destroy_decompress (&cinfo);
    fclose (infile);
 